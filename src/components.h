@@ -0,0 +1,2141 @@
+#ifndef COMP6771_COMPONENTS_H
+#define COMP6771_COMPONENTS_H
+
+#include "./pipeline.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <numbers>
+#include <optional>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace ppl {
+	/**
+	 * Helper Functions
+	 */
+	namespace internal {
+		inline auto hash_combine(std::size_t seed, std::size_t hash) noexcept -> std::size_t {
+			return seed ^ (hash + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2));
+		}
+
+		template <typename... Ts>
+		struct tuple_hash {
+			auto operator()(const std::tuple<Ts...>& key) const -> std::size_t {
+				return std::apply([](const auto&... items) {
+					std::size_t seed = 0;
+					((seed = hash_combine(seed, std::hash<std::decay_t<decltype(items)>>{}(items))), ...);
+					return seed;
+				}, key);
+			}
+		};
+
+		// Store `src` as the producer of slot `slot` in a tuple of typed input pointers.
+		template <typename Input, typename Producers, std::size_t... Indexes>
+		void connect_slot(Producers& producers, const node* src, int slot, std::index_sequence<Indexes...>) {
+			((static_cast<int>(Indexes) == slot
+			  ? void(std::get<Indexes>(producers) =
+			           static_cast<const producer<std::tuple_element_t<Indexes, Input>>*>(src))
+			  : void()), ...);
+		}
+
+		// The slots of an open-addressing hash table with linear probing, kept at most half full so
+		// that probe sequences stay short. A default-constructed `Slot` is empty; every slot has the
+		// `hash` of its key and an `occupied()` test. Erasing shifts later slots of the probe sequence
+		// back into the gap, so the table needs no tombstones.
+		template <typename Slot>
+		class probe_table {
+		 public:
+			// The occupied slot with `hash` for which `match` holds, or else the empty slot where it
+			// would go. Needs at least one slot.
+			template <typename Match>
+			[[nodiscard]] auto find(std::size_t hash, Match match) const -> std::size_t {
+				auto i = hash & mask();
+				while (slots_[i].occupied() && !(slots_[i].hash == hash && match(slots_[i]))) {
+					i = next(i);
+				}
+				return i;
+			}
+			// The empty slot where a new key with `hash` goes.
+			[[nodiscard]] auto free_slot(std::size_t hash) const -> std::size_t {
+				auto i = hash & mask();
+				while (slots_[i].occupied()) {
+					i = next(i);
+				}
+				return i;
+			}
+
+			// Make room for `count` occupied slots, moving every slot into a bigger table if need be.
+			void reserve(std::size_t count) {
+				if (count * 2 <= slots_.size()) {
+					return;
+				}
+				auto size = std::max<std::size_t>(slots_.size(), 16);
+				while (size < count * 2) {
+					size *= 2;
+				}
+				auto old = std::exchange(slots_, std::vector<Slot>(size));
+				for (auto& item: old) {
+					if (item.occupied()) {
+						slots_[free_slot(item.hash)] = std::move(item);
+					}
+				}
+			}
+
+			// Empty the slot at `i`, shifting later slots of the probe sequence back into the gap.
+			void erase(std::size_t i) {
+				slots_[i] = Slot();
+				for (auto j = next(i); slots_[j].occupied(); j = next(j)) {
+					const auto home = slots_[j].hash & mask();
+					// Move the slot back unless its home lies cyclically in (i, j]
+					const auto stays = i <= j ? (i < home && home <= j) : (i < home || home <= j);
+					if (!stays) {
+						slots_[i] = std::move(slots_[j]);
+						slots_[j] = Slot();
+						i = j;
+					}
+				}
+			}
+
+			// Empty every slot, keeping the memory.
+			void clear() {
+				for (auto& item: slots_) {
+					item = Slot();
+				}
+			}
+
+			[[nodiscard]] auto operator[](std::size_t i) -> Slot& {
+				return slots_[i];
+			}
+			[[nodiscard]] auto operator[](std::size_t i) const -> const Slot& {
+				return slots_[i];
+			}
+			[[nodiscard]] auto slot_count() const noexcept -> std::size_t {
+				return slots_.size();
+			}
+			[[nodiscard]] auto next(std::size_t i) const noexcept -> std::size_t {
+				return (i + 1) & mask();
+			}
+
+		 private:
+			[[nodiscard]] auto mask() const noexcept -> std::size_t {
+				return slots_.size() - 1;
+			}
+
+			std::vector<Slot> slots_;
+		};
+
+		// A fixed-size, linear-probing hash table that evicts with the CLOCK algorithm once full:
+		// each lookup marks its entry as referenced, and the clock hand evicts the first entry it
+		// finds that has not been referenced since the hand last passed it.
+		template <typename K, typename V, typename Hash = std::hash<K>>
+		class clock_cache {
+		 public:
+			explicit clock_cache(std::size_t capacity): capacity_(std::max<std::size_t>(capacity, 1)) {
+				slots_.reserve(capacity_);
+			}
+
+			[[nodiscard]] auto find(const K& key) -> V* {
+				const auto i = slots_.find(Hash{}(key), [&key](const entry& item) {
+					return item.item->first == key;
+				});
+				if (!slots_[i].occupied()) {
+					return nullptr;
+				}
+				slots_[i].referenced = true;
+				return &slots_[i].item->second;
+			}
+
+			// Insert a key that is not in the cache yet, evicting another entry if it is full.
+			auto insert(const K& key, const V& value) -> V* {
+				if (size_ == capacity_) {
+					evict();
+				}
+				const auto hash = Hash{}(key);
+				const auto i = slots_.free_slot(hash);
+				slots_[i] = {std::pair<K, V>(key, value), hash, false};
+				++size_;
+				return &slots_[i].item->second;
+			}
+
+			[[nodiscard]] auto size() const noexcept -> std::size_t {
+				return size_;
+			}
+
+		 private:
+			struct entry {
+				std::optional<std::pair<K, V>> item;
+				std::size_t hash = 0;
+				bool referenced = false;
+
+				[[nodiscard]] auto occupied() const noexcept -> bool {
+					return item.has_value();
+				}
+			};
+
+			void evict() {
+				while (true) {
+					auto& slot = slots_[hand_];
+					if (slot.item && !slot.referenced) {
+						slots_.erase(hand_);
+						--size_;
+						return;
+					}
+					slot.referenced = false;
+					hand_ = slots_.next(hand_);
+				}
+			}
+
+			std::size_t capacity_;
+			std::size_t size_ = 0;
+			std::size_t hand_ = 0;
+			probe_table<entry> slots_;
+		};
+	}
+
+	/**
+	 * Memoisation
+	 */
+	// Wraps a pure component, and remembers the values it produced for up to `capacity` distinct
+	// inputs. When the same inputs come again, the remembered value is used and the component is not
+	// polled. Only ready values are remembered.
+	template <typename C>
+	struct memoised: component<typename C::input_type, typename C::output_type> {
+		static_assert(pure_node<C>, "only a pure component can be memoised");
+		using input_type = typename C::input_type;
+		using output_type = typename C::output_type;
+		static constexpr bool is_pure = true;
+
+		template <typename... Args>
+		requires std::constructible_from<C, Args...>
+		explicit memoised(std::size_t capacity, Args&&... args)
+		: inner_(std::forward<Args>(args)...), capacity_(capacity), cache_(capacity) {}
+
+		auto operator==(const memoised& other) const -> bool {
+			return capacity_ == other.capacity_ && inner_ == other.inner_;
+		}
+
+		[[nodiscard]] auto name() const -> std::string override {
+			return "Memoised " + inner_.name();
+		}
+
+		void connect(const node* src, int slot) override {
+			static_cast<node&>(inner_).connect(src, slot);
+			internal::connect_slot<input_type>(producers_, src, slot, indexes());
+		}
+
+		auto poll_next() -> poll override {
+			const auto key = read_key(indexes());
+			if (auto cached = cache_.find(key)) {
+				++hits_;
+				current_ = cached;
+				return poll::ready;
+			}
+			++misses_;
+			const auto res = static_cast<node&>(inner_).poll_next();
+			if (res == poll::ready) {
+				current_ = cache_.insert(key, inner_.value());
+			}
+			return res;
+		}
+
+		auto value() const -> const output_type& override {
+			return *current_;
+		}
+
+		[[nodiscard]] auto hits() const noexcept -> std::size_t {
+			return hits_;
+		}
+		[[nodiscard]] auto misses() const noexcept -> std::size_t {
+			return misses_;
+		}
+
+	 private:
+		template <typename Tuple>
+		struct key_of;
+		template <typename... Ins>
+		struct key_of<std::tuple<Ins...>> {
+			using type = std::tuple<Ins...>;
+			using hash = internal::tuple_hash<Ins...>;
+			using producers = std::tuple<const producer<Ins>*...>;
+		};
+		using key_type = typename key_of<input_type>::type;
+
+		static constexpr auto indexes() noexcept {
+			return std::make_index_sequence<std::tuple_size_v<input_type>>{};
+		}
+		template <std::size_t... Indexes>
+		auto read_key(std::index_sequence<Indexes...>) const -> key_type {
+			return key_type(std::get<Indexes>(producers_)->value()...);
+		}
+
+		C inner_;
+		std::size_t capacity_;
+		typename key_of<input_type>::producers producers_{};
+		internal::clock_cache<key_type, output_type, typename key_of<input_type>::hash> cache_;
+		// Points into the cache, which only changes in the next `poll_next()`
+		const output_type* current_ = nullptr;
+		std::size_t hits_ = 0;
+		std::size_t misses_ = 0;
+	};
+
+	/**
+	 * Merging
+	 */
+	// Merges sorted streams into one sorted stream. Each value comes from the input with the smallest
+	// head, found with a loser tree in O(log n) comparisons. While the input that has to be looked at
+	// next is empty, nothing is produced, so that values never come out of order. Equal values come
+	// from the lower slot first. Closes once every input is closed and drained.
+	template <typename T, typename Compare = std::less<T>>
+	struct merge_sorted: component<many<T>, T> {
+		explicit merge_sorted(std::size_t inputs, Compare compare = Compare())
+		: component<many<T>, T>(inputs, input_mode::select), compare_(std::move(compare)), tree_(inputs) {}
+
+		[[nodiscard]] auto name() const -> std::string override {
+			return "MergeSorted";
+		}
+
+		auto poll_next() -> poll override {
+			const auto size = this->inputs().size();
+			if (!built_) {
+				// Every input has to show its first value, or be closed
+				for (std::size_t i = 0; i < size; ++i) {
+					if (this->input_state(i) == poll::empty) {
+						return poll::empty;
+					}
+				}
+				build();
+				built_ = true;
+			} else if (last_) {
+				// Only the input that the last value came from has moved on
+				if (this->input_state(*last_) == poll::empty) {
+					return poll::empty;
+				}
+				replay(*last_);
+				last_.reset();
+			}
+			if (size == 0 || exhausted(tree_[0])) {
+				return poll::closed;
+			}
+			const auto winner = tree_[0];
+			current_ = this->inputs()[winner]->value();
+			this->consume(winner);
+			last_ = winner;
+			return poll::ready;
+		}
+
+		auto value() const -> const T& override {
+			return *current_;
+		}
+
+	 private:
+		[[nodiscard]] auto exhausted(std::size_t i) const -> bool {
+			return this->input_state(i) == poll::closed;
+		}
+		// Whether the head of input `a` comes before the head of input `b`.
+		[[nodiscard]] auto less(std::size_t a, std::size_t b) const -> bool {
+			if (exhausted(a) || exhausted(b)) {
+				return !exhausted(a);
+			}
+			const auto& x = this->inputs()[a]->value();
+			const auto& y = this->inputs()[b]->value();
+			return compare_(x, y) || (!compare_(y, x) && a < b);
+		}
+		// The leaves are inputs 0 to k - 1 at positions k to 2k - 1, and the parent of position p is
+		// p / 2. Positions 1 to k - 1 keep the loser of the match there, and position 0 the winner.
+		void build() {
+			const auto k = tree_.size();
+			if (k == 0) {
+				return;
+			}
+			std::vector<std::size_t> winners(2 * k);
+			for (std::size_t i = 0; i < k; ++i) {
+				winners[k + i] = i;
+			}
+			for (auto p = k - 1; p >= 1; --p) {
+				auto winner = winners[2 * p];
+				auto loser = winners[2 * p + 1];
+				if (less(loser, winner)) {
+					std::swap(winner, loser);
+				}
+				winners[p] = winner;
+				tree_[p] = loser;
+			}
+			tree_[0] = winners[1];
+		}
+		// Play the matches on the path from input `leaf` to the root again, after its head changed.
+		void replay(std::size_t leaf) {
+			auto winner = leaf;
+			for (auto p = (tree_.size() + leaf) / 2; p >= 1; p /= 2) {
+				if (less(tree_[p], winner)) {
+					std::swap(tree_[p], winner);
+				}
+			}
+			tree_[0] = winner;
+		}
+
+		Compare compare_;
+		std::vector<std::size_t> tree_;
+		bool built_ = false;
+		// The input whose value was produced last, and which is consumed in this step.
+		std::optional<std::size_t> last_;
+		std::optional<T> current_;
+	};
+
+	/**
+	 * Windowing
+	 */
+	// The aggregates of the values in one window, which covers the positions or times in [start, end).
+	// The variance is that of the population.
+	struct window_stats {
+		std::int64_t start = 0;
+		std::int64_t end = 0;
+		std::size_t count = 0;
+		double sum = 0;
+		double min = 0;
+		double max = 0;
+		double mean = 0;
+		double variance = 0;
+	};
+
+	// The shape of a window: `size` long, and moved on by `slide` each time.
+	struct window {
+		std::int64_t size = 1;
+		std::int64_t slide = 1;
+
+		// Windows that follow each other without overlapping.
+		static auto tumbling(std::int64_t size) noexcept -> window {
+			return {size, size};
+		}
+		// Windows that start every `slide`, and overlap when `slide` is shorter than `size`.
+		static auto hopping(std::int64_t size, std::int64_t slide) noexcept -> window {
+			return {size, slide};
+		}
+		// A window that ends at every value.
+		static auto sliding(std::int64_t size) noexcept -> window {
+			return {size, 0};
+		}
+	};
+
+	// A value with the time it happened at.
+	template <typename T>
+	struct timed {
+		std::int64_t time = 0;
+		T value = T();
+	};
+
+	namespace internal {
+		inline auto floor_div(std::int64_t a, std::int64_t b) noexcept -> std::int64_t {
+			const auto q = a / b;
+			return a % b != 0 && (a < 0) != (b < 0) ? q - 1 : q;
+		}
+
+		// The values in a window, oldest first, each with the position or time it came at. Adding and
+		// evicting a value are O(1) amortised: the sum, mean and variance are updated on the way in and
+		// out, and the minimum and maximum come from a queue made of two stacks, each entry of which
+		// keeps the minimum and maximum of the entries below it.
+		class window_aggregate {
+		 public:
+			void push(std::int64_t key, double value) {
+				const auto below = back_.empty() ? entry{key, value, value, value} : back_.back();
+				back_.push_back({key, value, std::min(below.min, value), std::max(below.max, value)});
+				sum_ += value;
+				const auto delta = value - mean_;
+				mean_ += delta / static_cast<double>(size());
+				m2_ += delta * (value - mean_);
+			}
+
+			void pop() {
+				if (front_.empty()) {
+					// Reverse the newer stack into the older one
+					while (!back_.empty()) {
+						const auto& item = back_.back();
+						const auto below = front_.empty() ? entry{item.key, item.value, item.value, item.value}
+						                                  : front_.back();
+						front_.push_back(
+						   {item.key, item.value, std::min(below.min, item.value), std::max(below.max, item.value)});
+						back_.pop_back();
+					}
+				}
+				const auto value = front_.back().value;
+				front_.pop_back();
+				sum_ -= value;
+				if (empty()) {
+					sum_ = mean_ = m2_ = 0;
+					return;
+				}
+				const auto delta = value - mean_;
+				mean_ -= delta / static_cast<double>(size());
+				m2_ = std::max(m2_ - delta * (value - mean_), 0.0);
+			}
+
+			// Evict every value that came before `key`.
+			void evict_before(std::int64_t key) {
+				while (!empty() && oldest() < key) {
+					pop();
+				}
+			}
+
+			[[nodiscard]] auto empty() const noexcept -> bool {
+				return front_.empty() && back_.empty();
+			}
+			[[nodiscard]] auto size() const noexcept -> std::size_t {
+				return front_.size() + back_.size();
+			}
+			[[nodiscard]] auto oldest() const -> std::int64_t {
+				return front_.empty() ? back_.front().key : front_.back().key;
+			}
+
+			[[nodiscard]] auto stats(std::int64_t start, std::int64_t end) const -> window_stats {
+				auto min = front_.empty() ? back_.back().min : front_.back().min;
+				auto max = front_.empty() ? back_.back().max : front_.back().max;
+				if (!front_.empty() && !back_.empty()) {
+					min = std::min(min, back_.back().min);
+					max = std::max(max, back_.back().max);
+				}
+				const auto count = size();
+				return {start, end, count, sum_, min, max, mean_, m2_ / static_cast<double>(count)};
+			}
+
+		 private:
+			struct entry {
+				std::int64_t key = 0;
+				double value = 0;
+				double min = 0;
+				double max = 0;
+			};
+
+			// The older values, with the oldest on top, and the newer ones, with the newest on top
+			std::vector<entry> front_;
+			std::vector<entry> back_;
+			double sum_ = 0;
+			// Welford's running mean, and sum of squared differences from it
+			double mean_ = 0;
+			double m2_ = 0;
+		};
+	}
+
+	// Aggregates windows over the positions of the values in a stream. Window k covers positions
+	// [k * slide, k * slide + size), and is produced as soon as its last value came in. A sliding
+	// window moves on by one value, and is only produced once full. When the input closes, the
+	// windows that are still incomplete are produced before this closes too.
+	template <typename T>
+	struct count_window: component<std::tuple<T>, window_stats> {
+		explicit count_window(window shape)
+		: component<std::tuple<T>, window_stats>(input_mode::select), size_(std::max<std::int64_t>(shape.size, 1)),
+		  slide_(shape.slide > 0 ? shape.slide : 1), flush_(shape.slide > 0) {}
+
+		[[nodiscard]] auto name() const -> std::string override {
+			return "CountWindow";
+		}
+
+		void connect(const node* src, int) override {
+			input_ = static_cast<const producer<T>*>(src);
+		}
+
+		auto poll_next() -> poll override {
+			switch (this->input_state(0)) {
+				case poll::empty:
+					return poll::empty;
+				case poll::closed:
+					// Produce the incomplete windows one after another
+					if (!flush_ || aggregate_.empty() || start_ >= position_) {
+						return poll::closed;
+					}
+					current_ = aggregate_.stats(start_, start_ + size_);
+					advance();
+					return poll::ready;
+				case poll::ready:
+					break;
+			}
+			this->consume(0);
+			const auto position = position_++;
+			if (position < start_) {
+				// Between two windows
+				return poll::empty;
+			}
+			aggregate_.push(position, static_cast<double>(input_->value()));
+			if (position_ != start_ + size_) {
+				return poll::empty;
+			}
+			current_ = aggregate_.stats(start_, start_ + size_);
+			advance();
+			return poll::ready;
+		}
+
+		auto value() const -> const window_stats& override {
+			return current_;
+		}
+
+	 private:
+		void advance() {
+			start_ += slide_;
+			aggregate_.evict_before(start_);
+		}
+
+		std::int64_t size_;
+		std::int64_t slide_;
+		bool flush_;
+		const producer<T>* input_ = nullptr;
+		internal::window_aggregate aggregate_;
+		// The start of the oldest window not produced yet, and the position of the next value
+		std::int64_t start_ = 0;
+		std::int64_t position_ = 0;
+		window_stats current_;
+	};
+
+	// Aggregates windows over the times of the values in a stream, which have to come in order of
+	// time. Tumbling and hopping windows start at the multiples of `slide`, and each covers the times
+	// [start, start + size). A window is produced once a value at or after its end comes in, and
+	// windows without any value are skipped. A value that comes after its windows were produced is
+	// dropped. A sliding window covers the times (t - size, t], and is produced at every value t.
+	// A window is also produced as soon as the watermark of the input passes its end, and a sliding
+	// window evicts the values that no later window can cover. A value before the watermark is late,
+	// and dropped. When the input closes, the windows that are still open are produced before this
+	// closes too.
+	template <typename T>
+	struct time_window: component<std::tuple<timed<T>>, window_stats> {
+		explicit time_window(window shape)
+		: component<std::tuple<timed<T>>, window_stats>(input_mode::select),
+		  size_(std::max<std::int64_t>(shape.size, 1)), slide_(std::max<std::int64_t>(shape.slide, 0)) {
+			// A window may start before the watermark of its input, so it never passes that on
+			this->advance_watermark(no_watermark);
+		}
+
+		[[nodiscard]] auto name() const -> std::string override {
+			return "TimeWindow";
+		}
+
+		void connect(const node* src, int) override {
+			input_ = static_cast<const producer<timed<T>>*>(src);
+		}
+
+		auto poll_next() -> poll override {
+			const auto watermark = this->input_watermark();
+			if (slide_ != 0 && !aggregate_.empty() && start_ + size_ <= watermark) {
+				// No value can come in this window any more
+				current_ = aggregate_.stats(start_, start_ + size_);
+				advance(start_ + slide_);
+				return poll::ready;
+			}
+			if (slide_ == 0 && watermark > no_watermark + size_) {
+				aggregate_.evict_before(watermark - size_ + 1);
+				this->advance_watermark(watermark - size_ + 1);
+			}
+			switch (this->input_state(0)) {
+				case poll::empty:
+					return poll::empty;
+				case poll::closed:
+					// Produce the open windows one after another
+					if (slide_ == 0 || aggregate_.empty()) {
+						return poll::closed;
+					}
+					current_ = aggregate_.stats(start_, start_ + size_);
+					advance(start_ + slide_);
+					return poll::ready;
+				case poll::ready:
+					break;
+			}
+			const auto& [time, value] = input_->value();
+			if (!started_) {
+				start_ = slide_ == 0 ? time : align(time);
+				started_ = true;
+			}
+			if (slide_ == 0) {
+				this->consume(0);
+				if (time < start_ || time < watermark) {
+					return poll::empty;
+				}
+				start_ = time;
+				aggregate_.push(time, static_cast<double>(value));
+				aggregate_.evict_before(time - size_ + 1);
+				current_ = aggregate_.stats(time - size_ + 1, time + 1);
+				return poll::ready;
+			}
+			while (time >= start_ + size_) {
+				// The window is complete. The value stays on the input until it can be added
+				const auto produced = !aggregate_.empty();
+				if (produced) {
+					current_ = aggregate_.stats(start_, start_ + size_);
+				}
+				advance(start_ + slide_);
+				if (aggregate_.empty()) {
+					// Skip the windows without any value
+					advance(std::max(start_, align(time)));
+				}
+				if (produced) {
+					return poll::ready;
+				}
+			}
+			this->consume(0);
+			if (time >= start_ && time >= watermark) {
+				aggregate_.push(time, static_cast<double>(value));
+			}
+			return poll::empty;
+		}
+
+		auto value() const -> const window_stats& override {
+			return current_;
+		}
+
+	 private:
+		// The start of the first window that covers `time`.
+		[[nodiscard]] auto align(std::int64_t time) const noexcept -> std::int64_t {
+			return (internal::floor_div(time - size_, slide_) + 1) * slide_;
+		}
+		void advance(std::int64_t start) {
+			start_ = start;
+			aggregate_.evict_before(start_);
+			// No window produced later starts before this one
+			this->advance_watermark(start_);
+		}
+
+		std::int64_t size_;
+		std::int64_t slide_;
+		const producer<timed<T>>* input_ = nullptr;
+		internal::window_aggregate aggregate_;
+		bool started_ = false;
+		// The start of the oldest window not produced yet, or the time of the last value when sliding
+		std::int64_t start_ = 0;
+		window_stats current_;
+	};
+
+	/**
+	 * Event Time
+	 */
+	// Puts the values of a stream that comes out of order back in order of time, using the watermark
+	// of its input: a value is held back until the watermark passes its time, and values at the same
+	// time keep the order they came in. A value before the watermark is late, and dropped. Anything
+	// that needs its input in order, such as `time_window`, can then follow it.
+	template <typename T>
+	struct reorder: component<std::tuple<timed<T>>, timed<T>> {
+		reorder(): component<std::tuple<timed<T>>, timed<T>>(input_mode::select) {
+			this->advance_watermark(no_watermark);
+		}
+
+		[[nodiscard]] auto name() const -> std::string override {
+			return "Reorder";
+		}
+
+		void connect(const node* src, int) override {
+			input_ = static_cast<const producer<timed<T>>*>(src);
+		}
+
+		auto poll_next() -> poll override {
+			const auto watermark = this->input_watermark();
+			const auto state = this->input_state(0);
+			if (state == poll::ready) {
+				this->consume(0);
+				const auto& item = input_->value();
+				if (item.time < watermark) {
+					++late_;
+				} else {
+					held_.push({item, next_++});
+				}
+			}
+			auto res = state == poll::closed && held_.empty() ? poll::closed : poll::empty;
+			if (!held_.empty() && held_.top().item.time < watermark) {
+				current_ = held_.top().item;
+				held_.pop();
+				res = poll::ready;
+			}
+			// Whatever is still held back comes out later
+			this->advance_watermark(held_.empty() ? watermark : std::min(watermark, held_.top().item.time));
+			return res;
+		}
+
+		auto value() const -> const timed<T>& override {
+			return current_;
+		}
+
+		// The number of values dropped for coming after the watermark had passed them.
+		[[nodiscard]] auto late() const noexcept -> std::size_t {
+			return late_;
+		}
+
+	 private:
+		struct held {
+			timed<T> item;
+			std::uint64_t order = 0;
+
+			// The earliest value is on top of the heap
+			auto operator<(const held& other) const noexcept -> bool {
+				return item.time != other.item.time ? item.time > other.item.time : order > other.order;
+			}
+		};
+
+		const producer<timed<T>>* input_ = nullptr;
+		std::priority_queue<held> held_;
+		std::uint64_t next_ = 0;
+		std::size_t late_ = 0;
+		timed<T> current_;
+	};
+
+	/**
+	 * Joining
+	 */
+	// How long a value waits on one side of a join for values on the other side. Two values match
+	// when their times are at most `time` apart, and each side keeps only its newest `count` values.
+	struct join_bound {
+		std::int64_t time = std::numeric_limits<std::int64_t>::max();
+		std::size_t count = std::numeric_limits<std::size_t>::max();
+
+		static auto within(std::int64_t time) noexcept -> join_bound {
+			return {std::max<std::int64_t>(time, 0), std::numeric_limits<std::size_t>::max()};
+		}
+		static auto last(std::size_t count) noexcept -> join_bound {
+			return {std::numeric_limits<std::int64_t>::max(), count};
+		}
+	};
+
+	namespace internal {
+		// The values kept on one side of a join, oldest first, found by key through an open-addressing
+		// table. Each slot of the table holds the oldest and newest value with its key, and the values
+		// with the same key are chained from oldest to newest, so that evicting the oldest value only
+		// ever moves the head of its chain.
+		template <typename K, typename V, typename Hash>
+		class join_side {
+		 public:
+			static constexpr auto none = std::numeric_limits<std::uint64_t>::max();
+
+			struct entry {
+				K key;
+				std::size_t hash = 0;
+				timed<V> item;
+				// The next value with the same key
+				std::uint64_t next = none;
+			};
+
+			void push(K key, const timed<V>& item) {
+				slots_.reserve(keys_ + 1);
+				const auto hash = Hash{}(key);
+				const auto i = find_slot(key, hash);
+				const auto position = first_ + entries_.size();
+				if (slots_[i].head == none) {
+					slots_[i] = {hash, position, position};
+					++keys_;
+				} else {
+					at(slots_[i].tail).next = position;
+					slots_[i].tail = position;
+				}
+				entries_.push_back({std::move(key), hash, item, none});
+			}
+
+			// Evict the oldest value.
+			void pop() {
+				const auto& oldest = entries_.front();
+				const auto i = find_slot(oldest.key, oldest.hash);
+				if (oldest.next == none) {
+					slots_.erase(i);
+					--keys_;
+				} else {
+					slots_[i].head = oldest.next;
+				}
+				entries_.pop_front();
+				++first_;
+			}
+
+			void clear() noexcept {
+				entries_.clear();
+				slots_.clear();
+				first_ = 0;
+				keys_ = 0;
+			}
+
+			// The oldest value with `key`, or `none`.
+			[[nodiscard]] auto find(const K& key) const -> std::uint64_t {
+				return slots_.slot_count() == 0 ? none : slots_[find_slot(key, Hash{}(key))].head;
+			}
+			[[nodiscard]] auto at(std::uint64_t position) const -> const entry& {
+				return entries_[static_cast<std::size_t>(position - first_)];
+			}
+			[[nodiscard]] auto oldest() const -> const entry& {
+				return entries_.front();
+			}
+			[[nodiscard]] auto empty() const noexcept -> bool {
+				return entries_.empty();
+			}
+			[[nodiscard]] auto size() const noexcept -> std::size_t {
+				return entries_.size();
+			}
+
+		 private:
+			struct slot {
+				std::size_t hash = 0;
+				std::uint64_t head = none;
+				std::uint64_t tail = none;
+
+				[[nodiscard]] auto occupied() const noexcept -> bool {
+					return head != none;
+				}
+			};
+
+			[[nodiscard]] auto at(std::uint64_t position) -> entry& {
+				return entries_[static_cast<std::size_t>(position - first_)];
+			}
+			// The slot holding `key`, or the empty slot where it would go.
+			[[nodiscard]] auto find_slot(const K& key, std::size_t hash) const -> std::size_t {
+				return slots_.find(hash, [this, &key](const slot& item) {
+					return at(item.head).key == key;
+				});
+			}
+
+			std::deque<entry> entries_;
+			probe_table<slot> slots_;
+			// The position of the oldest value, counting every value ever pushed
+			std::uint64_t first_ = 0;
+			std::size_t keys_ = 0;
+		};
+
+		// How far apart two times are, without overflowing.
+		inline auto time_distance(std::int64_t a, std::int64_t b) noexcept -> std::uint64_t {
+			return a < b ? static_cast<std::uint64_t>(b) - static_cast<std::uint64_t>(a)
+			             : static_cast<std::uint64_t>(a) - static_cast<std::uint64_t>(b);
+		}
+	}
+
+	// Joins two keyed streams: each value is matched with the values kept on the other side that have
+	// the same key and are within the time bound, and every match is produced as a pair at the later
+	// of the two times, one per step. Each input has to come in order of time. A value is evicted once
+	// its side holds more than the count bound, or once the other side, or the watermark, has moved
+	// past it by more than the time bound. Whichever input has a value is taken from, alternating
+	// when both do, so a side that is empty never holds back the other. Once one side closes, the
+	// other side keeps nothing, and this closes when both have.
+	template <typename K, typename L, typename R, typename Hash = std::hash<K>>
+	struct hash_join: component<std::tuple<timed<L>, timed<R>>, timed<std::pair<L, R>>> {
+		hash_join(join_bound bound, std::function<K(const L&)> left_key, std::function<K(const R&)> right_key)
+		: component<std::tuple<timed<L>, timed<R>>, timed<std::pair<L, R>>>(input_mode::select), bound_(bound),
+		  left_key_(std::move(left_key)), right_key_(std::move(right_key)) {}
+
+		[[nodiscard]] auto name() const -> std::string override {
+			return "HashJoin";
+		}
+
+		void connect(const node* src, int slot) override {
+			if (slot == 0) {
+				left_input_ = static_cast<const producer<timed<L>>*>(src);
+			} else {
+				right_input_ = static_cast<const producer<timed<R>>*>(src);
+			}
+		}
+
+		auto poll_next() -> poll override {
+			if (next_match()) {
+				return poll::ready;
+			}
+			const auto left = this->input_state(0);
+			const auto right = this->input_state(1);
+			// Nothing the other side can still match is kept
+			if (left == poll::closed) {
+				right_.clear();
+			}
+			if (right == poll::closed) {
+				left_.clear();
+			}
+			const auto watermark = this->input_watermark();
+			if (watermark != no_watermark) {
+				evict(left_, watermark);
+				evict(right_, watermark);
+			}
+			if (left == poll::closed && right == poll::closed) {
+				return poll::closed;
+			}
+			auto side = std::size_t{0};
+			if (left == poll::ready && right == poll::ready) {
+				side = 1 - last_side_;
+			} else if (right == poll::ready) {
+				side = 1;
+			} else if (left != poll::ready) {
+				return poll::empty;
+			}
+			last_side_ = side;
+			this->consume(side);
+			if (side == 0) {
+				left_probe_ = left_input_->value();
+				auto key = left_key_(left_probe_.value);
+				latest_left_ = std::max(latest_left_, left_probe_.time);
+				evict(right_, latest_left_);
+				cursor_ = right_.find(key);
+				if (right != poll::closed) {
+					keep(left_, std::move(key), left_probe_);
+				}
+			} else {
+				right_probe_ = right_input_->value();
+				auto key = right_key_(right_probe_.value);
+				latest_right_ = std::max(latest_right_, right_probe_.time);
+				evict(left_, latest_right_);
+				cursor_ = left_.find(key);
+				if (left != poll::closed) {
+					keep(right_, std::move(key), right_probe_);
+				}
+			}
+			return next_match() ? poll::ready : poll::empty;
+		}
+
+		auto value() const -> const timed<std::pair<L, R>>& override {
+			return current_;
+		}
+
+		// The number of values kept on both sides.
+		[[nodiscard]] auto held() const noexcept -> std::size_t {
+			return left_.size() + right_.size();
+		}
+
+	 private:
+		template <typename Side, typename V>
+		void keep(Side& side, K key, const timed<V>& item) {
+			side.push(std::move(key), item);
+			while (side.size() > bound_.count) {
+				side.pop();
+			}
+		}
+
+		// Evict the values that no value at or after `time` on the other side can match.
+		template <typename Side>
+		void evict(Side& side, std::int64_t time) {
+			while (!side.empty() && side.oldest().item.time < time
+			       && internal::time_distance(side.oldest().item.time, time) > static_cast<std::uint64_t>(bound_.time)) {
+				side.pop();
+			}
+		}
+
+		// Produce the next match of the last value taken, if there is one.
+		auto next_match() -> bool {
+			if (last_side_ == 0) {
+				return next_match(right_, left_probe_, [](const auto& left, const auto& right) {
+					return std::pair<L, R>(left, right);
+				});
+			}
+			return next_match(left_, right_probe_, [](const auto& right, const auto& left) {
+				return std::pair<L, R>(left, right);
+			});
+		}
+		template <typename Side, typename V, typename Pair>
+		auto next_match(const Side& other, const timed<V>& probe, Pair pair) -> bool {
+			while (cursor_ != Side::none) {
+				const auto& match = other.at(cursor_);
+				cursor_ = match.next;
+				if (internal::time_distance(probe.time, match.item.time) <= static_cast<std::uint64_t>(bound_.time)) {
+					current_ = {std::max(probe.time, match.item.time), pair(probe.value, match.item.value)};
+					return true;
+				}
+			}
+			return false;
+		}
+
+		join_bound bound_;
+		std::function<K(const L&)> left_key_;
+		std::function<K(const R&)> right_key_;
+		const producer<timed<L>>* left_input_ = nullptr;
+		const producer<timed<R>>* right_input_ = nullptr;
+		internal::join_side<K, L, Hash> left_;
+		internal::join_side<K, R, Hash> right_;
+		// The latest time taken from each side
+		std::int64_t latest_left_ = no_watermark;
+		std::int64_t latest_right_ = no_watermark;
+		// The value taken last, from `last_side_`, and the next value on the other side to match it with
+		timed<L> left_probe_;
+		timed<R> right_probe_;
+		std::size_t last_side_ = 1;
+		std::uint64_t cursor_ = internal::join_side<K, L, Hash>::none;
+		timed<std::pair<L, R>> current_;
+	};
+
+	/**
+	 * Grouping
+	 */
+	// The aggregates of the values of one key, over the times in [start, end).
+	template <typename K>
+	struct group_stats {
+		K key = K();
+		std::int64_t start = no_watermark;
+		std::int64_t end = final_watermark;
+		std::size_t count = 0;
+		double sum = 0;
+		double min = 0;
+		double max = 0;
+	};
+
+	namespace internal {
+		// The groups of a `group_by`, kept contiguous in the order their keys first came, with an
+		// open-addressing table from each key to its group.
+		template <typename K, typename Hash>
+		class group_table {
+		 public:
+			static constexpr auto none = std::numeric_limits<std::size_t>::max();
+
+			// The index of the group of `key`, or `none`.
+			[[nodiscard]] auto find(const K& key, std::size_t hash) const -> std::size_t {
+				if (slots_.slot_count() == 0) {
+					return none;
+				}
+				return slots_[slots_.find(hash, [this, &key](const slot& item) {
+					return groups_[item.group].key == key;
+				})].group;
+			}
+
+			// Add a group for a key that has none yet.
+			auto insert(const K& key, std::size_t hash) -> std::size_t {
+				slots_.reserve(groups_.size() + 1);
+				slots_[slots_.free_slot(hash)] = {hash, groups_.size()};
+				groups_.push_back({key});
+				return groups_.size() - 1;
+			}
+
+			[[nodiscard]] auto at(std::size_t group) -> group_stats<K>& {
+				return groups_[group];
+			}
+			[[nodiscard]] auto size() const noexcept -> std::size_t {
+				return groups_.size();
+			}
+
+			// Take every group out, leaving the table empty but keeping its memory.
+			void take(std::vector<group_stats<K>>& out) {
+				out.swap(groups_);
+				groups_.clear();
+				slots_.clear();
+			}
+
+		 private:
+			struct slot {
+				std::size_t hash = 0;
+				std::size_t group = none;
+
+				[[nodiscard]] auto occupied() const noexcept -> bool {
+					return group != none;
+				}
+			};
+
+			std::vector<group_stats<K>> groups_;
+			probe_table<slot> slots_;
+		};
+
+		template <typename T>
+		struct is_batch: std::false_type {};
+		template <typename T>
+		struct is_batch<std::vector<timed<T>>>: std::true_type {};
+	}
+
+	// Aggregates the values of a stream by key, each key keeping its aggregates inline in a flat
+	// table. The groups are produced one per step, in the order their keys first came, once the input
+	// closes, once the table holds `capacity` keys and another one comes, and with a `window`, once a
+	// value or the watermark passes the end of the tumbling window of that size the groups cover.
+	// A value before its window is late, and dropped. Groups produced because the table was full are
+	// partial: more of the same key may follow, and a later `group_by` can combine them.
+	//
+	// The input is either one timed value, or a batch of them, `std::vector<timed<T>>`, which is
+	// aggregated all in one step unless it fills the table or crosses a window. A run of values with
+	// the same key is aggregated into its group without looking the key up again.
+	template <typename K, typename T, typename Hash = std::hash<K>, typename Input = timed<T>>
+	struct group_by: component<std::tuple<Input>, group_stats<K>> {
+		static_assert(std::is_same_v<Input, timed<T>> || internal::is_batch<Input>::value,
+		              "a group_by takes a timed value or a batch of them");
+
+		explicit group_by(std::function<K(const T&)> key, std::int64_t window = 0,
+		                  std::size_t capacity = std::numeric_limits<std::size_t>::max())
+		: component<std::tuple<Input>, group_stats<K>>(input_mode::select), key_(std::move(key)),
+		  window_(std::max<std::int64_t>(window, 0)), capacity_(std::max<std::size_t>(capacity, 1)) {
+			// A group may start before the watermark of its input, so it never passes that on
+			this->advance_watermark(no_watermark);
+		}
+
+		[[nodiscard]] auto name() const -> std::string override {
+			return "GroupBy";
+		}
+
+		void connect(const node* src, int) override {
+			input_ = static_cast<const producer<Input>*>(src);
+		}
+
+		auto poll_next() -> poll override {
+			if (next_group()) {
+				return poll::ready;
+			}
+			if (window_ != 0 && table_.size() != 0 && this->input_watermark() >= start_ + window_) {
+				// No value can come in this window any more
+				flush();
+				advance(start_ + window_);
+				return next_group() ? poll::ready : poll::empty;
+			}
+			switch (this->input_state(0)) {
+				case poll::empty:
+					return poll::empty;
+				case poll::closed:
+					flush();
+					return next_group() ? poll::ready : poll::closed;
+				case poll::ready:
+					break;
+			}
+			const auto& input = input_->value();
+			if constexpr (internal::is_batch<Input>::value) {
+				for (; offset_ < input.size(); ++offset_) {
+					if (!add(input[offset_])) {
+						// The rest of the batch is aggregated once these groups are produced
+						return next_group() ? poll::ready : poll::empty;
+					}
+				}
+				offset_ = 0;
+			} else {
+				if (!add(input)) {
+					return next_group() ? poll::ready : poll::empty;
+				}
+			}
+			this->consume(0);
+			return poll::empty;
+		}
+
+		auto value() const -> const group_stats<K>& override {
+			return out_[next_ - 1];
+		}
+
+		// The number of values dropped for coming before their window.
+		[[nodiscard]] auto late() const noexcept -> std::size_t {
+			return late_;
+		}
+
+	 private:
+		// Aggregate `item`, unless the groups have to be produced first.
+		auto add(const timed<T>& item) -> bool {
+			if (window_ != 0) {
+				if (!started_) {
+					advance(align(item.time));
+					started_ = true;
+				}
+				if (item.time < start_) {
+					++late_;
+					return true;
+				}
+				if (item.time >= start_ + window_) {
+					const auto any = table_.size() != 0;
+					flush();
+					advance(align(item.time));
+					if (any) {
+						return false;
+					}
+				}
+			}
+			auto key = key_(item.value);
+			if (last_ == internal::group_table<K, Hash>::none || !(table_.at(last_).key == key)) {
+				const auto hash = Hash{}(key);
+				last_ = table_.find(key, hash);
+				if (last_ == internal::group_table<K, Hash>::none) {
+					if (table_.size() >= capacity_) {
+						flush();
+						return false;
+					}
+					last_ = table_.insert(key, hash);
+				}
+			}
+			auto& group = table_.at(last_);
+			const auto value = static_cast<double>(item.value);
+			group.min = group.count == 0 ? value : std::min(group.min, value);
+			group.max = group.count == 0 ? value : std::max(group.max, value);
+			group.sum += value;
+			++group.count;
+			return true;
+		}
+
+		// Hand the groups over to be produced.
+		void flush() {
+			table_.take(out_);
+			next_ = 0;
+			last_ = internal::group_table<K, Hash>::none;
+			if (window_ != 0) {
+				for (auto& group: out_) {
+					group.start = start_;
+					group.end = start_ + window_;
+				}
+			}
+		}
+		auto next_group() -> bool {
+			if (next_ == out_.size()) {
+				return false;
+			}
+			++next_;
+			return true;
+		}
+
+		[[nodiscard]] auto align(std::int64_t time) const noexcept -> std::int64_t {
+			return internal::floor_div(time, window_) * window_;
+		}
+		void advance(std::int64_t start) {
+			start_ = start;
+			// No group produced later starts before this window
+			this->advance_watermark(start_);
+		}
+
+		std::function<K(const T&)> key_;
+		std::int64_t window_;
+		std::size_t capacity_;
+		const producer<Input>* input_ = nullptr;
+		internal::group_table<K, Hash> table_;
+		// The group of the last value aggregated, while it is still in the table
+		std::size_t last_ = internal::group_table<K, Hash>::none;
+		// The groups being produced, and the number of them produced so far
+		std::vector<group_stats<K>> out_;
+		std::size_t next_ = 0;
+		// The next value of a batch to aggregate
+		std::size_t offset_ = 0;
+		bool started_ = false;
+		std::int64_t start_ = 0;
+		std::size_t late_ = 0;
+	};
+
+	// A `group_by` over batches of timed values.
+	template <typename K, typename T, typename Hash = std::hash<K>>
+	using batch_group_by = group_by<K, T, Hash, std::vector<timed<T>>>;
+
+	/**
+	 * Sorting
+	 */
+	namespace internal {
+		// Sort `values` stably, splitting them between up to `threads` threads when there are enough of
+		// them: each thread sorts one chunk, and then neighbouring chunks are merged until one is left.
+		template <typename T, typename Compare>
+		void parallel_sort(std::vector<T>& values, const Compare& compare,
+		                   std::size_t threads = std::thread::hardware_concurrency()) {
+			constexpr auto min_chunk = std::size_t{1} << 14;
+			const auto chunks = std::min(threads, values.size() / min_chunk);
+			if (chunks < 2) {
+				std::stable_sort(values.begin(), values.end(), compare);
+				return;
+			}
+			auto bounds = std::vector<std::ptrdiff_t>(chunks + 1);
+			for (std::size_t i = 0; i <= chunks; ++i) {
+				bounds[i] = static_cast<std::ptrdiff_t>(values.size() * i / chunks);
+			}
+			const auto begin = values.begin();
+			{
+				std::vector<std::jthread> workers;
+				for (std::size_t i = 1; i < chunks; ++i) {
+					workers.emplace_back([&, i] { std::stable_sort(begin + bounds[i], begin + bounds[i + 1], compare); });
+				}
+				std::stable_sort(begin, begin + bounds[1], compare);
+			}
+			for (std::size_t width = 1; width < chunks; width *= 2) {
+				for (std::size_t i = 0; i + width < chunks; i += 2 * width) {
+					std::inplace_merge(begin + bounds[i], begin + bounds[i + width],
+					                   begin + bounds[std::min(i + 2 * width, chunks)], compare);
+				}
+			}
+		}
+	}
+
+	// Sorts a stream that may not fit in memory. Values are kept until they take up `memory` bytes,
+	// counted as a buffer counts them against the memory budget; that run is then sorted, written to a
+	// temporary file of its own, and the next run begins. Once there are `max_runs` runs, they are
+	// merged into one, so that no more than `max_runs` files are ever open. Once the input closes, the
+	// last run is sorted in memory, and the runs are merged with a heap of their heads, producing one
+	// value per step. The sort is stable.
+	// If a temporary file cannot be created or written, the values stay in memory from then on, and
+	// `spill_failed()` says so; values that cannot be read back from a file are lost.
+	template <typename T, typename Compare = std::less<T>>
+	struct external_sort: component<std::tuple<T>, T> {
+		static_assert(internal::spillable<T>, "an external sort needs a spill_codec for its values");
+
+		explicit external_sort(std::size_t memory, Compare compare = Compare(), std::size_t max_runs = 64)
+		: component<std::tuple<T>, T>(input_mode::select), memory_limit_(memory), compare_(std::move(compare)),
+		  max_runs_(std::max<std::size_t>(max_runs, 2)) {}
+
+		[[nodiscard]] auto name() const -> std::string override {
+			return "ExternalSort";
+		}
+
+		void connect(const node* src, int) override {
+			input_ = static_cast<const producer<T>*>(src);
+		}
+
+		auto poll_next() -> poll override {
+			if (!merging_) {
+				switch (this->input_state(0)) {
+					case poll::empty:
+						return poll::empty;
+					case poll::ready:
+						this->consume(0);
+						memory_.push_back(input_->value());
+						memory_bytes_ += internal::footprint(memory_.back());
+						if (memory_bytes_ >= memory_limit_ && !spill_failed_) {
+							spill();
+						}
+						return poll::empty;
+					case poll::closed:
+						start_merge();
+						break;
+				}
+			}
+			if (heap_.empty()) {
+				return poll::closed;
+			}
+			// The run with the smallest head is at the front of the heap
+			std::pop_heap(heap_.begin(), heap_.end(), later());
+			const auto run = heap_.back();
+			current_ = std::move(*head(run));
+			advance(run);
+			if (head(run)) {
+				std::push_heap(heap_.begin(), heap_.end(), later());
+			} else {
+				heap_.pop_back();
+			}
+			return poll::ready;
+		}
+
+		auto value() const -> const T& override {
+			return current_;
+		}
+
+		// The number of runs in temporary files.
+		[[nodiscard]] auto runs() const noexcept -> std::size_t {
+			return runs_.size();
+		}
+		// Whether a temporary file could not be created, written or read back.
+		[[nodiscard]] auto spill_failed() const noexcept -> bool {
+			return spill_failed_;
+		}
+
+	 private:
+		struct run {
+			std::unique_ptr<spill_file> file;
+			// The values still in the file
+			std::size_t remaining = 0;
+			// The next value of the run, once it has been read
+			std::optional<T> head;
+		};
+
+		// Sort the values in memory, and write them out as a run of their own.
+		void spill() {
+			auto file = std::make_unique<spill_file>();
+			if (!file->open()) {
+				// Not tried again for every value that follows
+				spill_failed_ = true;
+				return;
+			}
+			internal::parallel_sort(memory_, compare_);
+			try {
+				for (const auto& item: memory_) {
+					spill_codec<T>::write(*file, item);
+				}
+			} catch (...) {
+				// Every value is still in memory, and stays there
+				spill_failed_ = true;
+				return;
+			}
+			runs_.push_back({std::move(file), memory_.size(), std::nullopt});
+			memory_.clear();
+			memory_bytes_ = 0;
+			if (runs_.size() >= max_runs_) {
+				compact();
+			}
+		}
+
+		// Merge every run into a single one.
+		void compact() {
+			auto file = std::make_unique<spill_file>();
+			if (!file->open()) {
+				spill_failed_ = true;
+				return;
+			}
+			heap_.clear();
+			for (std::size_t i = 0; i < runs_.size(); ++i) {
+				if (!runs_[i].head) {
+					advance(i);
+				}
+				if (runs_[i].head) {
+					heap_.push_back(i);
+				}
+			}
+			std::make_heap(heap_.begin(), heap_.end(), later());
+			auto written = std::size_t{0};
+			while (!heap_.empty()) {
+				std::pop_heap(heap_.begin(), heap_.end(), later());
+				const auto i = heap_.back();
+				try {
+					spill_codec<T>::write(*file, *runs_[i].head);
+				} catch (...) {
+					// What was merged so far comes before anything left in the other runs, which stay
+					// as they are, each with its head
+					spill_failed_ = true;
+					break;
+				}
+				++written;
+				advance(i);
+				if (runs_[i].head) {
+					std::push_heap(heap_.begin(), heap_.end(), later());
+				} else {
+					heap_.pop_back();
+				}
+			}
+			heap_.clear();
+			auto merged = std::vector<run>();
+			merged.push_back({std::move(file), written, std::nullopt});
+			for (auto& item: runs_) {
+				if (item.head || item.remaining != 0) {
+					merged.push_back(std::move(item));
+				}
+			}
+			runs_ = std::move(merged);
+		}
+
+		void start_merge() {
+			merging_ = true;
+			internal::parallel_sort(memory_, compare_);
+			// The values still in memory came last, so they are the last run
+			for (std::size_t i = 0; i <= runs_.size(); ++i) {
+				if (!head(i)) {
+					advance(i);
+				}
+				if (head(i)) {
+					heap_.push_back(i);
+				}
+			}
+			std::make_heap(heap_.begin(), heap_.end(), later());
+		}
+
+		// The next value of run `i`, where the run after the last one in a file is the one in memory.
+		[[nodiscard]] auto head(std::size_t i) -> std::optional<T>& {
+			return i == runs_.size() ? memory_head_ : runs_[i].head;
+		}
+		[[nodiscard]] auto head(std::size_t i) const -> const std::optional<T>& {
+			return i == runs_.size() ? memory_head_ : runs_[i].head;
+		}
+		// Read the next value of run `i` into its head, which is left empty once the run is exhausted.
+		void advance(std::size_t i) {
+			head(i).reset();
+			if (i == runs_.size()) {
+				if (next_ == memory_.size()) {
+					memory_ = std::vector<T>();
+					return;
+				}
+				memory_head_ = std::move(memory_[next_++]);
+				return;
+			}
+			auto& item = runs_[i];
+			if (item.remaining == 0) {
+				item.file.reset();
+				return;
+			}
+			try {
+				item.head = spill_codec<T>::read(*item.file);
+				--item.remaining;
+			} catch (...) {
+				// The rest of this run is lost
+				spill_failed_ = true;
+				item.remaining = 0;
+				item.file.reset();
+			}
+		}
+
+		// Orders the heap so that the run with the smallest head, or the earliest run of equal heads,
+		// comes out first.
+		auto later() const {
+			return [this](std::size_t a, std::size_t b) {
+				return compare_(*head(b), *head(a)) || (!compare_(*head(a), *head(b)) && a > b);
+			};
+		}
+
+		std::size_t memory_limit_;
+		Compare compare_;
+		std::size_t max_runs_;
+		const producer<T>* input_ = nullptr;
+		std::vector<T> memory_;
+		std::size_t memory_bytes_ = 0;
+		bool spill_failed_ = false;
+		std::vector<run> runs_;
+		bool merging_ = false;
+		// The runs that have a head, and the head and position of the run in memory
+		std::vector<std::size_t> heap_;
+		std::optional<T> memory_head_;
+		std::size_t next_ = 0;
+		T current_ = T();
+	};
+
+	/**
+	 * Top-K and Heavy Hitters
+	 */
+	// Keeps the `k` largest values of a stream in a bounded heap, whose top is the smallest of them.
+	// Once the input closes, they are produced as one value, largest first; equal values keep the
+	// order they came in.
+	template <typename T, typename Compare = std::less<T>>
+	struct top_k: component<std::tuple<T>, std::vector<T>> {
+		explicit top_k(std::size_t k, Compare compare = Compare())
+		: component<std::tuple<T>, std::vector<T>>(input_mode::select), k_(k), compare_(std::move(compare)) {
+			heap_.reserve(k_);
+		}
+
+		[[nodiscard]] auto name() const -> std::string override {
+			return "TopK";
+		}
+
+		void connect(const node* src, int) override {
+			input_ = static_cast<const producer<T>*>(src);
+		}
+
+		auto poll_next() -> poll override {
+			switch (this->input_state(0)) {
+				case poll::empty:
+					return poll::empty;
+				case poll::closed:
+					if (done_) {
+						return poll::closed;
+					}
+					done_ = true;
+					std::sort_heap(heap_.begin(), heap_.end(), ranks_above());
+					current_.clear();
+					for (auto& item: heap_) {
+						current_.push_back(std::move(item.value));
+					}
+					heap_.clear();
+					return poll::ready;
+				case poll::ready:
+					break;
+			}
+			this->consume(0);
+			const auto& value = input_->value();
+			auto item = entry{value, seen_++};
+			if (heap_.size() < k_) {
+				heap_.push_back(std::move(item));
+				std::push_heap(heap_.begin(), heap_.end(), ranks_above());
+			} else if (k_ != 0 && ranks_above()(item, heap_.front())) {
+				std::pop_heap(heap_.begin(), heap_.end(), ranks_above());
+				heap_.back() = std::move(item);
+				std::push_heap(heap_.begin(), heap_.end(), ranks_above());
+			}
+			return poll::empty;
+		}
+
+		auto value() const -> const std::vector<T>& override {
+			return current_;
+		}
+
+	 private:
+		struct entry {
+			T value;
+			std::uint64_t order = 0;
+		};
+
+		// Whether `a` ranks above `b`: it is larger, or equal and came first. The heap keeps the entry
+		// ranked lowest on top.
+		auto ranks_above() const {
+			return [this](const entry& a, const entry& b) {
+				return compare_(b.value, a.value) || (!compare_(a.value, b.value) && a.order < b.order);
+			};
+		}
+
+		std::size_t k_;
+		Compare compare_;
+		const producer<T>* input_ = nullptr;
+		std::vector<entry> heap_;
+		std::uint64_t seen_ = 0;
+		bool done_ = false;
+		std::vector<T> current_;
+	};
+
+	// A key counted by a `space_saving` summary. Its true count is in [count - error, count].
+	template <typename K>
+	struct heavy_hitter {
+		K key = K();
+		std::uint64_t count = 0;
+		std::uint64_t error = 0;
+	};
+
+	// The Space-Saving summary: counts at most `capacity` keys, and when a key that is not counted
+	// comes, it takes over the smallest counter, adding to its count and taking it as its error. Any
+	// key whose true count is more than total() / capacity is always counted. The counters form a
+	// min-heap on their counts, so each update is O(log capacity).
+	template <typename K, typename Hash = std::hash<K>>
+	class space_saving {
+	 public:
+		explicit space_saving(std::size_t capacity): capacity_(std::max<std::size_t>(capacity, 1)) {
+			counters_.reserve(capacity_);
+			index_.reserve(capacity_);
+		}
+
+		void add(const K& key, std::uint64_t weight = 1) {
+			total_ += weight;
+			if (auto it = index_.find(key); it != index_.end()) {
+				counters_[it->second].count += weight;
+				sift_down(it->second);
+				return;
+			}
+			if (counters_.size() < capacity_) {
+				counters_.push_back({key, weight, 0});
+				index_.emplace(key, counters_.size() - 1);
+				sift_up(counters_.size() - 1);
+				return;
+			}
+			auto& smallest = counters_.front();
+			index_.erase(smallest.key);
+			smallest = {key, smallest.count + weight, smallest.count};
+			index_.emplace(key, 0);
+			sift_down(0);
+		}
+
+		// Combine with the summary of another part of the stream. A key that only one of them counts
+		// may have come up to the smallest count of the other, if that one is full.
+		void merge(const space_saving& other) {
+			const auto floor = full() ? counters_.front().count : 0;
+			const auto other_floor = other.full() ? other.counters_.front().count : 0;
+			auto all = std::vector<heavy_hitter<K>>();
+			all.reserve(counters_.size() + other.counters_.size());
+			for (const auto& item: counters_) {
+				const auto it = other.index_.find(item.key);
+				const auto& match = it != other.index_.end() ? other.counters_[it->second]
+				                                             : heavy_hitter<K>{item.key, other_floor, other_floor};
+				all.push_back({item.key, item.count + match.count, item.error + match.error});
+			}
+			for (const auto& item: other.counters_) {
+				if (!index_.contains(item.key)) {
+					all.push_back({item.key, item.count + floor, item.error + floor});
+				}
+			}
+			if (all.size() > capacity_) {
+				std::nth_element(all.begin(), all.begin() + static_cast<std::ptrdiff_t>(capacity_), all.end(),
+				                 [](const auto& a, const auto& b) { return a.count > b.count; });
+				all.resize(capacity_);
+			}
+			counters_ = std::move(all);
+			index_.clear();
+			for (std::size_t i = 0; i < counters_.size(); ++i) {
+				index_.emplace(counters_[i].key, i);
+			}
+			for (auto i = counters_.size() / 2; i-- > 0;) {
+				sift_down(i);
+			}
+			total_ += other.total_;
+		}
+
+		// The `n` keys with the largest counts, largest first.
+		[[nodiscard]] auto top(std::size_t n) const -> std::vector<heavy_hitter<K>> {
+			auto res = counters_;
+			std::sort(res.begin(), res.end(), [](const auto& a, const auto& b) {
+				return a.count != b.count ? a.count > b.count : a.error < b.error;
+			});
+			res.resize(std::min(n, res.size()));
+			return res;
+		}
+		// An upper bound of the count of `key`.
+		[[nodiscard]] auto estimate(const K& key) const -> std::uint64_t {
+			const auto it = index_.find(key);
+			return it != index_.end() ? counters_[it->second].count : full() ? counters_.front().count : 0;
+		}
+		[[nodiscard]] auto total() const noexcept -> std::uint64_t {
+			return total_;
+		}
+		[[nodiscard]] auto size() const noexcept -> std::size_t {
+			return counters_.size();
+		}
+
+	 private:
+		[[nodiscard]] auto full() const noexcept -> bool {
+			return counters_.size() == capacity_;
+		}
+		void swap_counters(std::size_t a, std::size_t b) {
+			std::swap(counters_[a], counters_[b]);
+			index_[counters_[a].key] = a;
+			index_[counters_[b].key] = b;
+		}
+		void sift_up(std::size_t i) {
+			while (i != 0 && counters_[i].count < counters_[(i - 1) / 2].count) {
+				swap_counters(i, (i - 1) / 2);
+				i = (i - 1) / 2;
+			}
+		}
+		void sift_down(std::size_t i) {
+			while (true) {
+				auto smallest = i;
+				for (const auto child: {2 * i + 1, 2 * i + 2}) {
+					if (child < counters_.size() && counters_[child].count < counters_[smallest].count) {
+						smallest = child;
+					}
+				}
+				if (smallest == i) {
+					return;
+				}
+				swap_counters(i, smallest);
+				i = smallest;
+			}
+		}
+
+		std::size_t capacity_;
+		std::vector<heavy_hitter<K>> counters_;
+		// The position of each counted key in the heap
+		std::unordered_map<K, std::size_t, Hash> index_;
+		std::uint64_t total_ = 0;
+	};
+
+	// The Count-Min sketch: `depth` rows of `width` counters, each row hashing a key to one of its
+	// counters. The smallest of the counters of a key is never below its true count, and is above it
+	// by at most e / width times total() with probability 1 - e^-depth. Summaries with the same width
+	// and depth merge by adding their counters; merging any other throws `std::invalid_argument`.
+	template <typename K, typename Hash = std::hash<K>>
+	class count_min {
+	 public:
+		count_min(std::size_t width, std::size_t depth)
+		: width_(std::max<std::size_t>(width, 1)), depth_(std::max<std::size_t>(depth, 1)),
+		  counters_(width_ * depth_) {}
+
+		// A sketch whose estimates are within `epsilon` times total() with probability 1 - `delta`.
+		static auto with_error(double epsilon, double delta) -> count_min {
+			const auto width = std::ceil(std::numbers::e / std::max(epsilon, 1e-9));
+			const auto depth = std::ceil(std::log(1 / std::clamp(delta, 1e-9, 1.0)));
+			return count_min(static_cast<std::size_t>(width), static_cast<std::size_t>(depth));
+		}
+
+		void add(const K& key, std::uint64_t weight = 1) {
+			const auto hash = Hash{}(key);
+			for (std::size_t row = 0; row < depth_; ++row) {
+				counters_[row * width_ + column(hash, row)] += weight;
+			}
+			total_ += weight;
+		}
+
+		void merge(const count_min& other) {
+			// Counters of different dimensions count different keys
+			if (width_ != other.width_ || depth_ != other.depth_) {
+				throw std::invalid_argument("count_min::merge: the sketches have different dimensions");
+			}
+			for (std::size_t i = 0; i < counters_.size(); ++i) {
+				counters_[i] += other.counters_[i];
+			}
+			total_ += other.total_;
+		}
+
+		// An upper bound of the count of `key`.
+		[[nodiscard]] auto estimate(const K& key) const -> std::uint64_t {
+			const auto hash = Hash{}(key);
+			auto res = std::numeric_limits<std::uint64_t>::max();
+			for (std::size_t row = 0; row < depth_; ++row) {
+				res = std::min(res, counters_[row * width_ + column(hash, row)]);
+			}
+			return res;
+		}
+		[[nodiscard]] auto total() const noexcept -> std::uint64_t {
+			return total_;
+		}
+
+	 private:
+		// Each row mixes the hash with its own seed, so that keys colliding in one row rarely collide
+		// in another
+		[[nodiscard]] auto column(std::size_t hash, std::size_t row) const noexcept -> std::size_t {
+			return internal::hash_combine(hash, 0x9e3779b97f4a7c15ULL * (row + 1)) % width_;
+		}
+
+		std::size_t width_;
+		std::size_t depth_;
+		std::vector<std::uint64_t> counters_;
+		std::uint64_t total_ = 0;
+	};
+
+	// Adds the key of every value of a stream to a sketch, such as a `space_saving` or a `count_min`,
+	// and produces the sketch once the input closes, and with `every`, after each `every` values too.
+	// Each sketch produced covers the whole stream so far.
+	template <typename K, typename T, typename Sketch = space_saving<K>>
+	struct heavy_hitters: component<std::tuple<T>, Sketch> {
+		heavy_hitters(std::function<K(const T&)> key, Sketch sketch, std::size_t every = 0)
+		: component<std::tuple<T>, Sketch>(input_mode::select), key_(std::move(key)), sketch_(std::move(sketch)),
+		  every_(every) {}
+
+		[[nodiscard]] auto name() const -> std::string override {
+			return "HeavyHitters";
+		}
+
+		void connect(const node* src, int) override {
+			input_ = static_cast<const producer<T>*>(src);
+		}
+
+		auto poll_next() -> poll override {
+			switch (this->input_state(0)) {
+				case poll::empty:
+					return poll::empty;
+				case poll::closed:
+					return std::exchange(done_, true) ? poll::closed : poll::ready;
+				case poll::ready:
+					break;
+			}
+			this->consume(0);
+			sketch_.add(key_(input_->value()));
+			return every_ != 0 && ++seen_ % every_ == 0 ? poll::ready : poll::empty;
+		}
+
+		auto value() const -> const Sketch& override {
+			return sketch_;
+		}
+
+	 private:
+		std::function<K(const T&)> key_;
+		Sketch sketch_;
+		std::size_t every_;
+		std::size_t seen_ = 0;
+		const producer<T>* input_ = nullptr;
+		bool done_ = false;
+	};
+
+	// Merges the sketches of the parts of a partitioned stream. Each input produces sketches that
+	// cover its part so far, so only the last of each is kept, and once every input has closed, they
+	// are merged into one that is produced.
+	template <typename Sketch>
+	struct merge_sketches: component<many<Sketch>, Sketch> {
+		explicit merge_sketches(std::size_t inputs)
+		: component<many<Sketch>, Sketch>(inputs, input_mode::select), last_(inputs) {}
+
+		[[nodiscard]] auto name() const -> std::string override {
+			return "MergeSketches";
+		}
+
+		auto poll_next() -> poll override {
+			auto open = false;
+			for (std::size_t i = 0; i < last_.size(); ++i) {
+				switch (this->input_state(i)) {
+					case poll::ready:
+						this->consume(i);
+						last_[i] = this->inputs()[i]->value();
+						open = true;
+						break;
+					case poll::empty:
+						open = true;
+						break;
+					case poll::closed:
+						break;
+				}
+			}
+			if (open || done_) {
+				return open ? poll::empty : poll::closed;
+			}
+			done_ = true;
+			for (auto& sketch: last_) {
+				if (!sketch) {
+					continue;
+				}
+				if (!current_) {
+					current_ = std::move(sketch);
+				} else {
+					current_->merge(*sketch);
+				}
+			}
+			return current_ ? poll::ready : poll::closed;
+		}
+
+		auto value() const -> const Sketch& override {
+			return *current_;
+		}
+
+	 private:
+		std::vector<std::optional<Sketch>> last_;
+		bool done_ = false;
+		std::optional<Sketch> current_;
+	};
+
+	/**
+	 * Deduplication
+	 */
+	namespace internal {
+		// The finaliser of SplitMix64, spreading any hash, even the identity hash of an integer, over
+		// all 64 bits.
+		inline auto mix64(std::uint64_t hash) noexcept -> std::uint64_t {
+			hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+			hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+			return hash ^ (hash >> 31);
+		}
+
+		// A split-block Bloom filter: each key maps to one cache line of eight 64-bit words, and sets
+		// one bit in each word, so a probe touches a single cache line. The eight words are checked
+		// with the same operations on every lane and no branches, so that the compiler can do them in
+		// a few vector instructions.
+		class blocked_bloom {
+		 public:
+			explicit blocked_bloom(std::size_t bits): blocks_(std::max<std::size_t>((bits + 511) / 512, 1)) {}
+
+			// Set the bits of `hash`, and return whether they were all set already.
+			auto insert(std::uint64_t hash) noexcept -> bool {
+				auto& block = blocks_[index(hash)];
+				const auto masks = lanes(hash);
+				auto missing = std::uint64_t{0};
+				for (std::size_t i = 0; i < lanes_per_block; ++i) {
+					missing |= masks[i] & ~block.words[i];
+					block.words[i] |= masks[i];
+				}
+				return missing == 0;
+			}
+			[[nodiscard]] auto contains(std::uint64_t hash) const noexcept -> bool {
+				const auto& block = blocks_[index(hash)];
+				const auto masks = lanes(hash);
+				auto missing = std::uint64_t{0};
+				for (std::size_t i = 0; i < lanes_per_block; ++i) {
+					missing |= masks[i] & ~block.words[i];
+				}
+				return missing == 0;
+			}
+			void clear() noexcept {
+				std::fill(blocks_.begin(), blocks_.end(), block());
+			}
+
+		 private:
+			static constexpr auto lanes_per_block = std::size_t{8};
+
+			struct alignas(64) block {
+				std::array<std::uint64_t, lanes_per_block> words{};
+			};
+
+			// The block is chosen by the upper half of the hash, and the bit in each word by the lower
+			// half multiplied by an odd constant of its own
+			[[nodiscard]] auto index(std::uint64_t hash) const noexcept -> std::size_t {
+				return static_cast<std::size_t>(((hash >> 32) * blocks_.size()) >> 32);
+			}
+			static auto lanes(std::uint64_t hash) noexcept -> std::array<std::uint64_t, lanes_per_block> {
+				constexpr auto salts = std::array<std::uint32_t, lanes_per_block>{
+				   0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU, 0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U};
+				const auto key = static_cast<std::uint32_t>(hash);
+				auto masks = std::array<std::uint64_t, lanes_per_block>();
+				for (std::size_t i = 0; i < lanes_per_block; ++i) {
+					masks[i] = std::uint64_t{1} << ((key * salts[i]) >> 26);
+				}
+				return masks;
+			}
+
+			std::vector<block> blocks_;
+		};
+
+		template <typename T>
+		struct is_timed: std::false_type {};
+		template <typename T>
+		struct is_timed<timed<T>>: std::true_type {};
+	}
+
+	// How a `dedup` remembers the keys it has seen.
+	struct dedup_policy {
+		// The keys each of the two generations of the filter holds before it is rotated.
+		std::size_t capacity = std::size_t{1} << 20;
+		// The bits of the filter per key. With 16, about 1 in 1000 new keys is taken for a duplicate.
+		std::size_t bits_per_key = 16;
+		// The number of recent keys kept exactly, to confirm what the filter finds; 0 for none.
+		std::size_t confirm = 0;
+		// With timed values, a generation is also rotated once it is this long; 0 for never.
+		std::int64_t period = 0;
+	};
+
+	// Drops the values whose key has been seen before, producing nothing in their step, so that the
+	// nodes after it skip them. The keys are remembered in two generations of a blocked Bloom filter:
+	// a key is a duplicate if either has it, and is added to the newer one. Once the newer one holds
+	// `capacity` keys, or covers `period`, it becomes the older one and the older one is cleared, so
+	// a key is remembered for at least one generation after it was last seen.
+	//
+	// A Bloom filter may take a new key for a duplicate. With `confirm`, such a key is only dropped if
+	// it is also among that many recent keys, kept exactly with the CLOCK algorithm; a duplicate that
+	// has been evicted from them is then let through instead.
+	template <typename K, typename T, typename Hash = std::hash<K>>
+	struct dedup: component<std::tuple<T>, T> {
+		dedup(std::function<K(const T&)> key, dedup_policy policy = dedup_policy())
+		: key_(std::move(key)), policy_(policy), newer_(policy.capacity * policy.bits_per_key),
+		  older_(policy.capacity * policy.bits_per_key) {
+			if (policy_.confirm != 0) {
+				recent_.emplace(policy_.confirm);
+			}
+		}
+
+		[[nodiscard]] auto name() const -> std::string override {
+			return "Dedup";
+		}
+
+		void connect(const node* src, int) override {
+			input_ = static_cast<const producer<T>*>(src);
+		}
+
+		auto poll_next() -> poll override {
+			const auto& item = input_->value();
+			if constexpr (internal::is_timed<T>::value) {
+				rotate_at(item.time);
+			}
+			const auto key = key_(item);
+			const auto hash = internal::mix64(static_cast<std::uint64_t>(Hash{}(key)));
+			// Inserted either way, so that a key seen again stays remembered after the next rotation
+			auto seen = newer_.insert(hash);
+			seen = older_.contains(hash) || seen;
+			if (!seen && ++inserted_ >= policy_.capacity) {
+				rotate();
+			}
+			if (recent_) {
+				const auto known = recent_->find(key) != nullptr;
+				if (!known) {
+					recent_->insert(key, true);
+				}
+				if (seen && !known) {
+					++false_positives_;
+					seen = false;
+				}
+			}
+			if (seen) {
+				++duplicates_;
+				return poll::empty;
+			}
+			current_ = item;
+			return poll::ready;
+		}
+
+		auto value() const -> const T& override {
+			return *current_;
+		}
+
+		// The number of values dropped.
+		[[nodiscard]] auto duplicates() const noexcept -> std::size_t {
+			return duplicates_;
+		}
+		// The number of keys the filter took for duplicates, but that were not among the recent keys.
+		[[nodiscard]] auto false_positives() const noexcept -> std::size_t {
+			return false_positives_;
+		}
+
+	 private:
+		void rotate() {
+			std::swap(newer_, older_);
+			newer_.clear();
+			inserted_ = 0;
+		}
+		void rotate_at(std::int64_t time) {
+			if (policy_.period == 0) {
+				return;
+			}
+			if (!started_) {
+				start_ = time;
+				started_ = true;
+			}
+			if (time - start_ >= 2 * policy_.period) {
+				// Both generations are too old
+				newer_.clear();
+				older_.clear();
+				inserted_ = 0;
+				start_ = time;
+			} else if (time - start_ >= policy_.period) {
+				rotate();
+				start_ = time;
+			}
+		}
+
+		std::function<K(const T&)> key_;
+		dedup_policy policy_;
+		const producer<T>* input_ = nullptr;
+		internal::blocked_bloom newer_;
+		internal::blocked_bloom older_;
+		std::size_t inserted_ = 0;
+		std::optional<internal::clock_cache<K, bool, Hash>> recent_;
+		bool started_ = false;
+		std::int64_t start_ = 0;
+		std::size_t duplicates_ = 0;
+		std::size_t false_positives_ = 0;
+		std::optional<T> current_;
+	};
+}
+
+#endif  // COMP6771_COMPONENTS_H
@@ -0,0 +1,962 @@
+#include "./components.h"
+
+#include <algorithm>
+#include <catch2/catch.hpp>
+#include <deque>
+#include <numeric>
+#include <random>
+#include <sstream>
+
+// Declare some example components
+struct flex_source: ppl::source<int> {
+	int current_value = 0;
+	int bound;
+
+	explicit flex_source(int bound): bound(bound) {};
+
+	auto name() const -> std::string override {
+		return "FlexSource: Bound = " + std::to_string(bound);
+	}
+
+	auto poll_next() -> ppl::poll override {
+		if (current_value >= bound)
+			return ppl::poll::closed;
+		++current_value;
+		return ppl::poll::ready;
+	}
+
+	auto value() const -> const int& override {
+		return current_value;
+	}
+};
+
+// A source that produces the given values, and then closes
+struct list_source: ppl::source<int> {
+	std::vector<int> values;
+	std::size_t next = 0;
+	int current_value = 0;
+
+	explicit list_source(std::vector<int> values): values(std::move(values)) {};
+
+	auto name() const -> std::string override {
+		return "ListSource";
+	}
+
+	auto poll_next() -> ppl::poll override {
+		if (next >= values.size())
+			return ppl::poll::closed;
+		current_value = values[next++];
+		return ppl::poll::ready;
+	}
+
+	auto value() const -> const int& override {
+		return current_value;
+	}
+};
+
+struct stream_sink: ppl::sink<int> {
+	const ppl::producer<int>* slot0 = nullptr;
+	std::stringstream& stream;
+
+	explicit stream_sink(std::stringstream& stream): stream(stream) {};
+
+	auto name() const -> std::string override {
+		return "StreamSink";
+	}
+
+	void connect(const ppl::node* src, int slot) override {
+		if (slot == 0) {
+			slot0 = dynamic_cast<const ppl::producer<int>*>(src);
+		}
+	}
+
+	auto poll_next() -> ppl::poll override {
+		stream << slot0->value() << ' ';
+		return ppl::poll::ready;
+	}
+};
+
+// An expensive pure component, counting how often it does the work
+struct square: ppl::component<std::tuple<int>, int> {
+	static constexpr bool is_pure = true;
+
+	const ppl::producer<int>* slot0 = nullptr;
+	int current_value = 0;
+	int& computed;
+
+	explicit square(int& computed): computed(computed) {};
+
+	auto operator==(const square&) const -> bool {
+		return true;
+	}
+
+	auto name() const -> std::string override {
+		return "Square";
+	}
+
+	void connect(const ppl::node* src, int slot) override {
+		if (slot == 0) {
+			slot0 = dynamic_cast<const ppl::producer<int>*>(src);
+		}
+	}
+
+	auto poll_next() -> ppl::poll override {
+		++computed;
+		current_value = slot0->value() * slot0->value();
+		return ppl::poll::ready;
+	}
+
+	auto value() const -> const int& override {
+		return current_value;
+	}
+};
+
+TEST_CASE("Test Case 1: A memoised component reuses the values of repeated inputs") {
+	ppl::pipeline p;
+	const int source = p.create_node<list_source>(std::vector<int>{3, 4, 3, 3, 5, 4});
+	int computed = 0;
+	const int memo = p.create_node<ppl::memoised<square>>(std::size_t{8}, computed);
+	std::stringstream stream;
+	const int sink = p.create_node<stream_sink>(stream);
+	REQUIRE_NOTHROW(p.connect(source, memo, 0));
+	REQUIRE_NOTHROW(p.connect(memo, sink, 0));
+	REQUIRE(p.is_valid());
+
+	p.run();
+	REQUIRE(stream.str() == "9 16 9 9 25 16 ");
+	REQUIRE(computed == 3);
+	const auto& node = dynamic_cast<const ppl::memoised<square>&>(*p.get_node(memo));
+	REQUIRE(node.hits() == 3);
+	REQUIRE(node.misses() == 3);
+	REQUIRE(node.name() == "Memoised Square");
+}
+
+TEST_CASE("Test Case 2: A memoised component never remembers more than its capacity") {
+	ppl::pipeline p;
+	const int source = p.create_node<flex_source>(100);
+	int computed = 0;
+	const int memo = p.create_node<ppl::memoised<square>>(std::size_t{4}, computed);
+	std::stringstream stream;
+	const int sink = p.create_node<stream_sink>(stream);
+	REQUIRE_NOTHROW(p.connect(source, memo, 0));
+	REQUIRE_NOTHROW(p.connect(memo, sink, 0));
+
+	p.run();
+	// Every input is new, so nothing is reused, but every value is still right
+	REQUIRE(computed == 100);
+	REQUIRE(stream.str().starts_with("1 4 9 16 25 "));
+	REQUIRE(stream.str().ends_with(" 9801 10000 "));
+}
+
+TEST_CASE("Test Case 3: The CLOCK cache evicts entries that have not been used since the hand last passed") {
+	auto cache = ppl::internal::clock_cache<int, int>(3);
+	cache.insert(1, 10);
+	cache.insert(2, 20);
+	cache.insert(3, 30);
+	REQUIRE(cache.size() == 3);
+
+	// 1 is referenced, so 2 is evicted first
+	REQUIRE(*cache.find(1) == 10);
+	cache.insert(4, 40);
+	REQUIRE(cache.size() == 3);
+	REQUIRE(cache.find(2) == nullptr);
+	REQUIRE(*cache.find(1) == 10);
+	REQUIRE(*cache.find(3) == 30);
+	REQUIRE(*cache.find(4) == 40);
+
+	// Many evictions keep every remaining entry reachable through its probe sequence
+	for (int i = 5; i < 1000; ++i) {
+		cache.insert(i, i * 10);
+		REQUIRE(*cache.find(i) == i * 10);
+	}
+	REQUIRE(cache.size() == 3);
+}
+
+// Produces the given values, but is empty on every other poll
+struct gappy_source: list_source {
+	bool gap = false;
+
+	explicit gappy_source(std::vector<int> values): list_source(std::move(values)) {};
+
+	auto poll_next() -> ppl::poll override {
+		gap = !gap;
+		return gap ? ppl::poll::empty : list_source::poll_next();
+	}
+};
+
+TEST_CASE("Test Case 4: merge_sorted merges sorted streams, waiting for inputs that are empty") {
+	ppl::pipeline p;
+	std::stringstream stream;
+	const auto merge = p.create_node<ppl::merge_sorted<int>>(std::size_t{3});
+	const auto sink = p.create_node<stream_sink>(stream);
+	p.connect(p.create_node<list_source>(std::vector<int>{1, 4, 7, 10}), merge, 0);
+	p.connect(p.create_node<gappy_source>(std::vector<int>{2, 5, 8}), merge, 1);
+	p.connect(p.create_node<list_source>(std::vector<int>{3, 3, 6, 9, 11, 12}), merge, 2);
+	p.connect(merge, sink, 0);
+	REQUIRE(p.is_valid());
+	p.run();
+	REQUIRE(stream.str() == "1 2 3 3 4 5 6 7 8 9 10 11 12 ");
+}
+
+TEST_CASE("Test Case 5: merge_sorted merges many streams of different lengths") {
+	auto random = std::mt19937(6771);
+	ppl::pipeline p;
+	std::stringstream stream;
+	const auto merge = p.create_node<ppl::merge_sorted<int>>(std::size_t{64});
+	p.connect(merge, p.create_node<stream_sink>(stream), 0);
+
+	std::vector<int> all;
+	for (int slot = 0; slot < 64; ++slot) {
+		auto values = std::vector<int>(random() % 20);
+		for (auto& value: values) {
+			value = static_cast<int>(random() % 1000);
+		}
+		std::sort(values.begin(), values.end());
+		all.insert(all.end(), values.begin(), values.end());
+		const auto source = slot % 2 == 0 ? p.create_node<list_source>(values) : p.create_node<gappy_source>(values);
+		p.connect(source, merge, slot);
+	}
+	p.run();
+
+	std::sort(all.begin(), all.end());
+	std::stringstream expected;
+	for (const auto value: all) {
+		expected << value << ' ';
+	}
+	REQUIRE(stream.str() == expected.str());
+}
+
+// Produces the given values at the given times, and then closes
+struct timed_source: ppl::source<ppl::timed<int>> {
+	std::vector<ppl::timed<int>> values;
+	std::size_t next = 0;
+
+	explicit timed_source(std::vector<ppl::timed<int>> values): values(std::move(values)) {};
+
+	auto name() const -> std::string override {
+		return "TimedSource";
+	}
+
+	auto poll_next() -> ppl::poll override {
+		return next < values.size() ? (++next, ppl::poll::ready) : ppl::poll::closed;
+	}
+
+	auto value() const -> const ppl::timed<int>& override {
+		return values[next - 1];
+	}
+};
+
+struct stats_sink: ppl::sink<ppl::window_stats> {
+	const ppl::producer<ppl::window_stats>* slot0 = nullptr;
+	std::vector<ppl::window_stats>& windows;
+
+	explicit stats_sink(std::vector<ppl::window_stats>& windows): windows(windows) {};
+
+	auto name() const -> std::string override {
+		return "StatsSink";
+	}
+
+	void connect(const ppl::node* src, int) override {
+		slot0 = dynamic_cast<const ppl::producer<ppl::window_stats>*>(src);
+	}
+
+	auto poll_next() -> ppl::poll override {
+		windows.push_back(slot0->value());
+		return ppl::poll::ready;
+	}
+};
+
+template <typename Window, typename Source, typename Values>
+auto run_window(ppl::window shape, Values values) -> std::vector<ppl::window_stats> {
+	auto windows = std::vector<ppl::window_stats>();
+	ppl::pipeline p;
+	const auto window = p.create_node<Window>(shape);
+	p.connect(p.create_node<Source>(std::move(values)), window, 0);
+	p.connect(window, p.create_node<stats_sink>(windows), 0);
+	p.run();
+	return windows;
+}
+
+TEST_CASE("Test Case 6: Count windows tumble, hop and slide over the positions of the values") {
+	using window = ppl::count_window<int>;
+	const auto tumbling = run_window<window, gappy_source>(ppl::window::tumbling(3),
+	                                                       std::vector<int>{1, 2, 3, 4, 5, 6, 7});
+	REQUIRE(tumbling.size() == 3);
+	REQUIRE(tumbling[0].sum == 6);
+	REQUIRE(tumbling[1].sum == 15);
+	// The last window is incomplete, and produced when the input closes
+	REQUIRE(tumbling[2].sum == 7);
+	REQUIRE(tumbling[2].count == 1);
+	REQUIRE(tumbling[2].start == 6);
+	REQUIRE(tumbling[2].end == 9);
+
+	const auto hopping = run_window<window, list_source>(ppl::window::hopping(4, 2),
+	                                                     std::vector<int>{1, 2, 3, 4, 5, 6});
+	REQUIRE(hopping.size() == 3);
+	REQUIRE(hopping[0].sum == 10);
+	REQUIRE(hopping[1].sum == 18);
+	REQUIRE(hopping[2].sum == 11);
+
+	// Values between two windows are left out
+	const auto gaps = run_window<window, list_source>(ppl::window::hopping(2, 3),
+	                                                  std::vector<int>{1, 2, 3, 4, 5, 6, 7});
+	REQUIRE(gaps.size() == 3);
+	REQUIRE(gaps[0].sum == 3);
+	REQUIRE(gaps[1].sum == 9);
+	REQUIRE(gaps[2].sum == 7);
+
+	const auto sliding = run_window<window, list_source>(ppl::window::sliding(3), std::vector<int>{5, 1, 4, 2, 8});
+	REQUIRE(sliding.size() == 3);
+	REQUIRE((sliding[0].min == 1 && sliding[0].max == 5));
+	REQUIRE((sliding[1].min == 1 && sliding[1].max == 4));
+	REQUIRE((sliding[2].min == 2 && sliding[2].max == 8));
+}
+
+TEST_CASE("Test Case 7: A sliding window keeps its aggregates exact as values are evicted") {
+	const auto stats = run_window<ppl::count_window<int>, list_source>(ppl::window::tumbling(8),
+	                                                                  std::vector<int>{2, 4, 4, 4, 5, 5, 7, 9});
+	REQUIRE(stats.size() == 1);
+	REQUIRE(stats[0].mean == Approx(5));
+	REQUIRE(stats[0].variance == Approx(4));
+
+	auto random = std::mt19937(6771);
+	auto values = std::vector<int>(500);
+	for (auto& value: values) {
+		value = static_cast<int>(random() % 1000) - 500;
+	}
+	const auto sliding = run_window<ppl::count_window<int>, list_source>(ppl::window::sliding(16), values);
+	REQUIRE(sliding.size() == values.size() - 15);
+	for (std::size_t i = 0; i < sliding.size(); ++i) {
+		const auto first = values.begin() + static_cast<std::ptrdiff_t>(i);
+		const auto last = first + 16;
+		auto sum = 0.0;
+		for (auto it = first; it != last; ++it) {
+			sum += *it;
+		}
+		const auto mean = sum / 16;
+		auto squares = 0.0;
+		for (auto it = first; it != last; ++it) {
+			squares += (*it - mean) * (*it - mean);
+		}
+		REQUIRE(sliding[i].count == 16);
+		REQUIRE(sliding[i].sum == sum);
+		REQUIRE(sliding[i].min == *std::min_element(first, last));
+		REQUIRE(sliding[i].max == *std::max_element(first, last));
+		REQUIRE(sliding[i].mean == Approx(mean));
+		REQUIRE(sliding[i].variance == Approx(squares / 16));
+	}
+}
+
+TEST_CASE("Test Case 8: Time windows are aligned to their slide, and skip the times without values") {
+	using window = ppl::time_window<int>;
+	const auto counts = [](const std::vector<ppl::window_stats>& windows) {
+		auto result = std::vector<std::size_t>();
+		for (const auto& stats: windows) {
+			result.push_back(stats.count);
+		}
+		return result;
+	};
+
+	const auto tumbling = run_window<window, timed_source>(
+	   ppl::window::tumbling(10), std::vector<ppl::timed<int>>{{1, 1}, {3, 2}, {12, 3}, {15, 4}, {37, 5}});
+	REQUIRE(counts(tumbling) == std::vector<std::size_t>{2, 2, 1});
+	REQUIRE((tumbling[1].start == 10 && tumbling[1].end == 20 && tumbling[1].sum == 7));
+	REQUIRE((tumbling[2].start == 30 && tumbling[2].end == 40));
+
+	const auto hopping = run_window<window, timed_source>(ppl::window::hopping(10, 5),
+	                                                      std::vector<ppl::timed<int>>{{1, 1}, {6, 2}, {12, 3}});
+	REQUIRE(counts(hopping) == std::vector<std::size_t>{1, 2, 2, 1});
+	REQUIRE((hopping[0].start == -5 && hopping[3].start == 10));
+
+	// A late value is dropped
+	const auto sliding = run_window<window, timed_source>(
+	   ppl::window::sliding(10), std::vector<ppl::timed<int>>{{1, 1}, {5, 2}, {12, 3}, {11, 9}, {30, 4}});
+	REQUIRE(counts(sliding) == std::vector<std::size_t>{1, 2, 2, 1});
+	REQUIRE((sliding[2].start == 3 && sliding[2].end == 13 && sliding[2].sum == 5));
+}
+
+// Produces the values and watermarks queued by the test, and stays open
+struct event_source: ppl::source<ppl::timed<int>> {
+	struct event {
+		std::int64_t time = 0;
+		int value = 0;
+		bool watermark = false;
+	};
+
+	std::deque<event>& events;
+	ppl::timed<int> current_value;
+
+	explicit event_source(std::deque<event>& events): events(events) {};
+
+	auto name() const -> std::string override {
+		return "EventSource";
+	}
+
+	auto poll_next() -> ppl::poll override {
+		if (events.empty()) {
+			return ppl::poll::empty;
+		}
+		const auto next = events.front();
+		events.pop_front();
+		if (next.watermark) {
+			advance_watermark(next.time);
+			return ppl::poll::empty;
+		}
+		current_value = {next.time, next.value};
+		return ppl::poll::ready;
+	}
+
+	auto value() const -> const ppl::timed<int>& override {
+		return current_value;
+	}
+};
+
+TEST_CASE("Test Case 9: Watermarks put a stream back in order, and close its windows before it ends") {
+	using event = event_source::event;
+	auto events = std::deque<event>();
+	auto windows = std::vector<ppl::window_stats>();
+	ppl::pipeline p;
+	const auto source = p.create_node<event_source>(events);
+	const auto order = p.create_node<ppl::reorder<int>>();
+	const auto window = p.create_node<ppl::time_window<int>>(ppl::window::tumbling(10));
+	p.connect(source, order, 0);
+	p.connect(order, window, 0);
+	p.connect(window, p.create_node<stats_sink>(windows), 0);
+	const auto steps = [&p](int count) {
+		for (int i = 0; i < count; ++i) {
+			REQUIRE_FALSE(p.step());
+		}
+	};
+
+	events = {{3, 1}, {12, 2}, {1, 3}, {7, 4}, {2, 0, true}};
+	steps(10);
+	// Nothing is produced until the watermark passes the end of the window
+	REQUIRE(windows.empty());
+	REQUIRE(p.get_node(order)->watermark() == 2);
+
+	events = {{15, 5}, {10, 0, true}, {5, 6}, {20, 0, true}};
+	steps(10);
+	REQUIRE(windows.size() == 2);
+	REQUIRE((windows[0].start == 0 && windows[0].count == 3 && windows[0].sum == 8));
+	REQUIRE((windows[1].start == 10 && windows[1].count == 2 && windows[1].sum == 7));
+	// The value at 5 came after the watermark had passed it
+	REQUIRE(dynamic_cast<const ppl::reorder<int>&>(*p.get_node(order)).late() == 1);
+	REQUIRE(p.get_node(window)->watermark() == 20);
+}
+
+// Collects every value of its input
+template <typename T>
+struct vector_sink: ppl::sink<T> {
+	const ppl::producer<T>* slot0 = nullptr;
+	std::vector<T>& values;
+
+	explicit vector_sink(std::vector<T>& values): values(values) {};
+
+	auto name() const -> std::string override {
+		return "VectorSink";
+	}
+
+	void connect(const ppl::node* src, int) override {
+		slot0 = dynamic_cast<const ppl::producer<T>*>(src);
+	}
+
+	auto poll_next() -> ppl::poll override {
+		values.push_back(slot0->value());
+		return ppl::poll::ready;
+	}
+};
+
+TEST_CASE("Test Case 10: A hash join matches keys within its bounds, and never waits on an empty side") {
+	using joined = ppl::timed<std::pair<int, int>>;
+	using event = event_source::event;
+	const auto key = [](const int& value) { return value / 10; };
+	const auto pairs = [](const std::vector<joined>& matches) {
+		auto res = std::vector<std::pair<int, int>>();
+		for (const auto& match: matches) {
+			res.push_back(match.value);
+		}
+		return res;
+	};
+
+	SECTION("Values are evicted once the other side moves past them by the time bound") {
+		auto events = std::deque<event>();
+		auto matches = std::vector<joined>();
+		ppl::pipeline p;
+		const auto join = p.create_node<ppl::hash_join<int, int, int>>(ppl::join_bound::within(5), key, key);
+		p.connect(p.create_node<timed_source>(std::vector<ppl::timed<int>>{{1, 10}, {2, 20}, {10, 11}}), join, 0);
+		p.connect(p.create_node<event_source>(events), join, 1);
+		p.connect(join, p.create_node<vector_sink<joined>>(matches), 0);
+		const auto& node = dynamic_cast<const ppl::hash_join<int, int, int>&>(*p.get_node(join));
+
+		for (int i = 0; i < 3; ++i) {
+			REQUIRE_FALSE(p.step());
+		}
+		// The left side was taken from while the right side had nothing
+		REQUIRE(node.held() == 3);
+		REQUIRE(matches.empty());
+
+		events = {{3, 12}, {12, 13}};
+		for (int i = 0; i < 5; ++i) {
+			REQUIRE_FALSE(p.step());
+		}
+		// The value at 10 is too far from the one at 3, and those at 1 and 2 from the one at 12
+		REQUIRE(pairs(matches) == std::vector<std::pair<int, int>>{{10, 12}, {11, 13}});
+		REQUIRE((matches[0].time == 3 && matches[1].time == 12));
+		// The left side has closed, so nothing on the right is kept
+		REQUIRE(node.held() == 1);
+	}
+
+	SECTION("Each side keeps only its newest values, and every match comes out") {
+		auto events = std::deque<event>();
+		auto matches = std::vector<joined>();
+		ppl::pipeline p;
+		const auto join = p.create_node<ppl::hash_join<int, int, int>>(ppl::join_bound::last(2), key, key);
+		p.connect(p.create_node<timed_source>(std::vector<ppl::timed<int>>{{1, 10}, {2, 11}, {3, 12}, {4, 20}, {5, 21}}),
+		          join, 0);
+		p.connect(p.create_node<event_source>(events), join, 1);
+		p.connect(join, p.create_node<vector_sink<joined>>(matches), 0);
+		for (int i = 0; i < 6; ++i) {
+			REQUIRE_FALSE(p.step());
+		}
+
+		// Only 20 and 21 are kept on the left, and are matched oldest first, one per step
+		events = {{6, 25}, {7, 13}};
+		for (int i = 0; i < 5; ++i) {
+			REQUIRE_FALSE(p.step());
+		}
+		REQUIRE(pairs(matches) == std::vector<std::pair<int, int>>{{20, 25}, {21, 25}});
+		REQUIRE((matches[0].time == 6 && matches[1].time == 6));
+	}
+}
+
+// Produces the given batches, and then closes
+struct batch_source: ppl::source<std::vector<ppl::timed<int>>> {
+	std::vector<std::vector<ppl::timed<int>>> batches;
+	std::size_t next = 0;
+
+	explicit batch_source(std::vector<std::vector<ppl::timed<int>>> batches): batches(std::move(batches)) {};
+
+	auto name() const -> std::string override {
+		return "BatchSource";
+	}
+
+	auto poll_next() -> ppl::poll override {
+		return next < batches.size() ? (++next, ppl::poll::ready) : ppl::poll::closed;
+	}
+
+	auto value() const -> const std::vector<ppl::timed<int>>& override {
+		return batches[next - 1];
+	}
+};
+
+TEST_CASE("Test Case 11: group_by aggregates by key, and produces its groups on close, when full and per window") {
+	using group = ppl::group_stats<int>;
+	const auto key = [](const int& value) { return value / 10; };
+	// The key, start and count of each group
+	const auto summary = [](const std::vector<group>& groups) {
+		auto res = std::vector<std::tuple<int, std::int64_t, std::size_t>>();
+		for (const auto& item: groups) {
+			res.emplace_back(item.key, item.start, item.count);
+		}
+		return res;
+	};
+	auto groups = std::vector<group>();
+	ppl::pipeline p;
+
+	SECTION("Without a window, every group is produced once the input closes") {
+		const auto by = p.create_node<ppl::group_by<int, int>>(key);
+		p.connect(p.create_node<timed_source>(std::vector<ppl::timed<int>>{{1, 10}, {2, 21}, {3, 12}, {4, 25}, {5, 11}}),
+		          by, 0);
+		p.connect(by, p.create_node<vector_sink<group>>(groups), 0);
+		p.run();
+		REQUIRE(groups.size() == 2);
+		REQUIRE((groups[0].key == 1 && groups[0].count == 3 && groups[0].sum == 33 && groups[0].min == 10
+		         && groups[0].max == 12));
+		REQUIRE((groups[1].key == 2 && groups[1].count == 2 && groups[1].sum == 46));
+		REQUIRE((groups[0].start == ppl::no_watermark && groups[0].end == ppl::final_watermark));
+	}
+
+	SECTION("A full table and the end of a window produce the groups early") {
+		const auto by = p.create_node<ppl::group_by<int, int>>(key, std::int64_t{10}, std::size_t{2});
+		p.connect(p.create_node<timed_source>(
+		             std::vector<ppl::timed<int>>{{1, 10}, {2, 20}, {3, 30}, {12, 11}, {25, 12}, {4, 13}}),
+		          by, 0);
+		p.connect(by, p.create_node<vector_sink<group>>(groups), 0);
+		p.run();
+		using row = std::tuple<int, std::int64_t, std::size_t>;
+		REQUIRE(summary(groups)
+		        == std::vector<row>{{1, 0, 1}, {2, 0, 1}, {3, 0, 1}, {1, 10, 1}, {1, 20, 1}});
+		REQUIRE(groups[3].end == 20);
+		REQUIRE(dynamic_cast<const ppl::group_by<int, int>&>(*p.get_node(by)).late() == 1);
+	}
+
+	SECTION("A batch is aggregated in one step, and split where the table fills") {
+		auto batches = std::vector<std::vector<ppl::timed<int>>>{{{1, 10}, {1, 11}, {2, 20}}, {{3, 12}, {3, 13}}};
+		const auto whole = p.create_node<ppl::batch_group_by<int, int>>(key);
+		const auto split = p.create_node<ppl::batch_group_by<int, int>>(key, std::int64_t{0}, std::size_t{1});
+		const auto source = p.create_node<batch_source>(batches);
+		auto split_groups = std::vector<group>();
+		p.connect(source, whole, 0);
+		p.connect(source, split, 0);
+		p.connect(whole, p.create_node<vector_sink<group>>(groups), 0);
+		p.connect(split, p.create_node<vector_sink<group>>(split_groups), 0);
+		p.run();
+		using row = std::tuple<int, std::int64_t, std::size_t>;
+		REQUIRE(summary(groups) == std::vector<row>{{1, ppl::no_watermark, 4}, {2, ppl::no_watermark, 1}});
+		REQUIRE(groups[0].sum == 46);
+		REQUIRE(summary(split_groups)
+		        == std::vector<row>{{1, ppl::no_watermark, 2}, {2, ppl::no_watermark, 1}, {1, ppl::no_watermark, 2}});
+	}
+}
+
+TEST_CASE("Test Case 12: An external sort spills sorted runs and merges them once its input closes") {
+	auto random = std::mt19937(6771);
+	auto values = std::vector<int>(1000);
+	for (auto& value: values) {
+		value = static_cast<int>(random() % 500);
+	}
+	ppl::pipeline p;
+	std::stringstream stream;
+	// Runs of 64 values
+	const auto sort = p.create_node<ppl::external_sort<int>>(64 * sizeof(int));
+	p.connect(p.create_node<list_source>(values), sort, 0);
+	p.connect(sort, p.create_node<stream_sink>(stream), 0);
+	p.run();
+
+	std::sort(values.begin(), values.end());
+	std::stringstream expected;
+	for (const auto value: values) {
+		expected << value << ' ';
+	}
+	REQUIRE(stream.str() == expected.str());
+	// The last 40 values never left memory
+	REQUIRE(dynamic_cast<const ppl::external_sort<int>&>(*p.get_node(sort)).runs() == 15);
+}
+
+TEST_CASE("Test Case 13: A parallel sort is stable") {
+	auto random = std::mt19937(6771);
+	auto values = std::vector<std::pair<int, int>>(200000);
+	for (std::size_t i = 0; i < values.size(); ++i) {
+		values[i] = {static_cast<int>(random() % 1000), static_cast<int>(i)};
+	}
+	const auto by_first = [](const auto& a, const auto& b) { return a.first < b.first; };
+	auto expected = values;
+	std::stable_sort(expected.begin(), expected.end(), by_first);
+	auto serial = values;
+	ppl::internal::parallel_sort(values, by_first, 5);
+	REQUIRE(values == expected);
+	ppl::internal::parallel_sort(serial, by_first, 1);
+	REQUIRE(serial == expected);
+}
+
+TEST_CASE("Test Case 14: top_k keeps the largest values in a bounded heap") {
+	ppl::pipeline p;
+	auto tops = std::vector<std::vector<int>>();
+	const auto top = p.create_node<ppl::top_k<int>>(std::size_t{3});
+	const auto bottom = p.create_node<ppl::top_k<int, std::greater<int>>>(std::size_t{2});
+	const auto source = p.create_node<list_source>(std::vector<int>{5, 1, 9, 3, 9, 7, 2, 8});
+	p.connect(source, top, 0);
+	p.connect(source, bottom, 0);
+	p.connect(top, p.create_node<vector_sink<std::vector<int>>>(tops), 0);
+	p.connect(bottom, p.create_node<vector_sink<std::vector<int>>>(tops), 0);
+	p.run();
+	REQUIRE(tops.size() == 2);
+	REQUIRE(std::find(tops.begin(), tops.end(), std::vector<int>{9, 9, 8}) != tops.end());
+	REQUIRE(std::find(tops.begin(), tops.end(), std::vector<int>{1, 2}) != tops.end());
+}
+
+TEST_CASE("Test Case 15: Sketches bound the counts of keys, and merge across partitions") {
+	// Key k comes 1000 / (k + 1) times, in a shuffled order
+	auto keys = std::vector<int>();
+	for (int key = 0; key < 200; ++key) {
+		keys.insert(keys.end(), static_cast<std::size_t>(1000 / (key + 1)), key);
+	}
+	std::shuffle(keys.begin(), keys.end(), std::mt19937(6771));
+	const auto count = [&keys](int key) {
+		return static_cast<std::uint64_t>(std::count(keys.begin(), keys.end(), key));
+	};
+	const auto half = keys.begin() + static_cast<std::ptrdiff_t>(keys.size() / 2);
+
+	SECTION("Space-Saving counts every key above total / capacity, and merges to the same top keys") {
+		auto whole = ppl::space_saving<int>(50);
+		auto left = ppl::space_saving<int>(50);
+		auto right = ppl::space_saving<int>(50);
+		for (auto it = keys.begin(); it != keys.end(); ++it) {
+			whole.add(*it);
+			(it < half ? left : right).add(*it);
+		}
+		left.merge(right);
+		REQUIRE(left.total() == keys.size());
+		for (const auto* summary: {&whole, &left}) {
+			const auto top = summary->top(5);
+			for (std::size_t i = 0; i < top.size(); ++i) {
+				REQUIRE(top[i].key == static_cast<int>(i));
+				REQUIRE((top[i].count >= count(top[i].key) && top[i].count - top[i].error <= count(top[i].key)));
+			}
+			REQUIRE(summary->size() == 50);
+		}
+	}
+
+	SECTION("Count-Min never underestimates, and merges by adding its counters") {
+		auto whole = ppl::count_min<int>::with_error(0.01, 0.01);
+		auto left = ppl::count_min<int>::with_error(0.01, 0.01);
+		auto right = ppl::count_min<int>::with_error(0.01, 0.01);
+		for (auto it = keys.begin(); it != keys.end(); ++it) {
+			whole.add(*it);
+			(it < half ? left : right).add(*it);
+		}
+		left.merge(right);
+		for (int key = 0; key < 200; ++key) {
+			REQUIRE(whole.estimate(key) >= count(key));
+			REQUIRE(whole.estimate(key) <= count(key) + keys.size() / 50);
+			REQUIRE(left.estimate(key) == whole.estimate(key));
+		}
+		auto narrow = ppl::count_min<int>(10, 5);
+		REQUIRE_THROWS_AS(whole.merge(narrow), std::invalid_argument);
+		REQUIRE_THROWS_AS(narrow.merge(ppl::count_min<int>(10, 4)), std::invalid_argument);
+		REQUIRE(whole.total() == keys.size());
+	}
+
+	SECTION("The sketches of a partitioned stream are merged into one") {
+		ppl::pipeline p;
+		auto merged = std::vector<ppl::space_saving<int>>();
+		const auto identity = [](const int& value) { return value; };
+		const auto merge = p.create_node<ppl::merge_sketches<ppl::space_saving<int>>>(std::size_t{2});
+		const auto parts = std::vector<std::vector<int>>{{keys.begin(), half}, {half, keys.end()}};
+		for (int part = 0; part < 2; ++part) {
+			const auto hitters =
+			   p.create_node<ppl::heavy_hitters<int, int>>(identity, ppl::space_saving<int>(20), std::size_t{100});
+			p.connect(p.create_node<list_source>(parts[static_cast<std::size_t>(part)]), hitters, 0);
+			p.connect(hitters, merge, part);
+		}
+		p.connect(merge, p.create_node<vector_sink<ppl::space_saving<int>>>(merged), 0);
+		p.run();
+		REQUIRE(merged.size() == 1);
+		// Only the last sketch of each part was merged
+		REQUIRE(merged[0].total() == keys.size());
+		REQUIRE(merged[0].top(1)[0].key == 0);
+	}
+}
+
+TEST_CASE("Test Case 16: dedup drops repeated keys, and forgets them two generations later") {
+	const auto identity = [](const int& value) { return value; };
+
+	SECTION("A blocked Bloom filter has no false negatives, and few false positives") {
+		auto filter = ppl::internal::blocked_bloom(10000 * 16);
+		for (std::uint64_t key = 0; key < 10000; ++key) {
+			filter.insert(ppl::internal::mix64(key));
+		}
+		auto positives = 0;
+		for (std::uint64_t key = 0; key < 20000; ++key) {
+			if (key < 10000) {
+				REQUIRE(filter.contains(ppl::internal::mix64(key)));
+			} else if (filter.contains(ppl::internal::mix64(key))) {
+				++positives;
+			}
+		}
+		REQUIRE(positives < 100);
+	}
+
+	SECTION("Duplicates produce nothing, and keys are forgotten after two rotations") {
+		ppl::pipeline p;
+		std::stringstream stream;
+		const auto policy = ppl::dedup_policy{.capacity = 3};
+		const auto filter = p.create_node<ppl::dedup<int, int>>(identity, policy);
+		p.connect(p.create_node<list_source>(std::vector<int>{1, 2, 1, 3, 2, 4, 5, 6, 7, 1, 1}), filter, 0);
+		p.connect(filter, p.create_node<stream_sink>(stream), 0);
+		p.run();
+		// 1, 2 and 3 fill the first generation, and 4, 5 and 6 the second, so 1 is new again at the end
+		REQUIRE(stream.str() == "1 2 3 4 5 6 7 1 ");
+		REQUIRE(dynamic_cast<const ppl::dedup<int, int>&>(*p.get_node(filter)).duplicates() == 3);
+	}
+
+	SECTION("Timed values rotate the generations by period") {
+		ppl::pipeline p;
+		auto values = std::vector<ppl::timed<int>>();
+		const auto key = [](const ppl::timed<int>& item) { return item.value; };
+		const auto filter = p.create_node<ppl::dedup<int, ppl::timed<int>>>(key, ppl::dedup_policy{.period = 10});
+		const auto times = std::vector<ppl::timed<int>>{{0, 1}, {5, 1}, {12, 1}, {15, 2}, {40, 1}, {41, 2}};
+		p.connect(p.create_node<timed_source>(times), filter, 0);
+		p.connect(filter, p.create_node<vector_sink<ppl::timed<int>>>(values), 0);
+		p.run();
+		// 1 was seen again at 12, which kept it for the next generation; nothing was seen between 15 and 40
+		REQUIRE(values.size() == 4);
+		REQUIRE((values[0].time == 0 && values[1].time == 15 && values[2].time == 40 && values[3].time == 41));
+	}
+
+	SECTION("Exact confirmation catches the false positives of a tiny filter") {
+		ppl::pipeline p;
+		std::stringstream stream;
+		auto values = std::vector<int>(500);
+		std::iota(values.begin(), values.end(), 0);
+		values.push_back(499);
+		// Every bit of a filter this small is soon set
+		const auto policy = ppl::dedup_policy{.capacity = 1000, .bits_per_key = 0, .confirm = 1000};
+		const auto filter = p.create_node<ppl::dedup<int, int>>(identity, policy);
+		p.connect(p.create_node<list_source>(values), filter, 0);
+		p.connect(filter, p.create_node<stream_sink>(stream), 0);
+		p.run();
+		const auto& node = dynamic_cast<const ppl::dedup<int, int>&>(*p.get_node(filter));
+		REQUIRE(node.duplicates() == 1);
+		REQUIRE(node.false_positives() > 0);
+	}
+}
+
+TEST_CASE("Test Case 17: A selecting node keeps a buffer even when asked for none") {
+	ppl::pipeline p;
+	std::stringstream stream;
+	const auto merge = p.create_node<ppl::merge_sorted<int>>(std::size_t{2});
+	p.connect(p.create_node<list_source>(std::vector<int>{1, 3, 5, 7}), merge, 0);
+	p.connect(p.create_node<list_source>(std::vector<int>{2, 4, 6, 8}), merge, 1);
+	p.connect(merge, p.create_node<stream_sink>(stream), 0);
+	p.set_buffer(merge, 0, 0);
+	p.run();
+	REQUIRE(stream.str() == "1 2 3 4 5 6 7 8 ");
+}
+
+// Produces the given strings, and then closes
+struct string_source: ppl::source<std::string> {
+	std::vector<std::string> values;
+	std::size_t next = 0;
+
+	explicit string_source(std::vector<std::string> values): values(std::move(values)) {};
+
+	auto name() const -> std::string override {
+		return "StringSource";
+	}
+
+	auto poll_next() -> ppl::poll override {
+		return next < values.size() ? (++next, ppl::poll::ready) : ppl::poll::closed;
+	}
+
+	auto value() const -> const std::string& override {
+		return values[next - 1];
+	}
+};
+
+TEST_CASE("Test Case 18: An external sort counts what its values own against its memory") {
+	auto values = std::vector<std::string>();
+	for (int i = 0; i < 40; ++i) {
+		values.push_back(std::string(100, static_cast<char>('a' + (i * 7) % 26)));
+	}
+	ppl::pipeline p;
+	auto sorted = std::vector<std::string>();
+	// Ten of these strings fit, though a hundred of their handles would
+	const auto sort = p.create_node<ppl::external_sort<std::string>>(10 * (sizeof(std::string) + 100));
+	p.connect(p.create_node<string_source>(values), sort, 0);
+	p.connect(sort, p.create_node<vector_sink<std::string>>(sorted), 0);
+	p.run();
+	std::sort(values.begin(), values.end());
+	REQUIRE(sorted == values);
+	REQUIRE(dynamic_cast<const ppl::external_sort<std::string>&>(*p.get_node(sort)).runs() == 4);
+}
+
+// Compares strings by their first letter only, so that a sort shows whether it is stable
+struct by_first_letter {
+	auto operator()(const std::string& a, const std::string& b) const -> bool {
+		return a.front() < b.front();
+	}
+};
+
+// A value whose spill files fail after a number of writes, as if the disk were full
+struct flaky {
+	int value = 0;
+
+	auto operator<=>(const flaky&) const = default;
+};
+
+namespace ppl {
+	template <>
+	struct spill_codec<flaky> {
+		static inline int writes_left = 0;
+
+		static void write(spill_file& file, const flaky& item) {
+			if (writes_left-- <= 0) {
+				throw pipeline_error(pipeline_error_kind::spill_failed);
+			}
+			file.write(&item.value, sizeof(int));
+		}
+		static auto read(spill_file& file) -> flaky {
+			auto item = flaky();
+			file.read(&item.value, sizeof(int));
+			return item;
+		}
+	};
+}
+
+// Produces the given values as flaky ones, and then closes
+struct flaky_source: ppl::source<flaky> {
+	std::vector<int> values;
+	std::size_t next = 0;
+	flaky current;
+
+	explicit flaky_source(std::vector<int> values): values(std::move(values)) {};
+
+	auto name() const -> std::string override {
+		return "FlakySource";
+	}
+
+	auto poll_next() -> ppl::poll override {
+		if (next >= values.size())
+			return ppl::poll::closed;
+		current.value = values[next++];
+		return ppl::poll::ready;
+	}
+
+	auto value() const -> const flaky& override {
+		return current;
+	}
+};
+
+TEST_CASE("Test Case 19: An external sort keeps few files open, and keeps its values when a file fails") {
+	SECTION("Runs are merged before there are max_runs of them, and the sort stays stable") {
+		auto values = std::vector<std::string>();
+		for (int i = 0; i < 300; ++i) {
+			values.push_back(static_cast<char>('a' + (i * 7) % 5) + std::to_string(i % 10));
+		}
+		ppl::pipeline p;
+		auto sorted = std::vector<std::string>();
+		// Runs of about ten values, so thirty of them without merging
+		const auto sort = p.create_node<ppl::external_sort<std::string, by_first_letter>>(
+		   10 * (sizeof(std::string) + 2), by_first_letter(), std::size_t{3});
+		p.connect(p.create_node<string_source>(values), sort, 0);
+		p.connect(sort, p.create_node<vector_sink<std::string>>(sorted), 0);
+		const auto& node = dynamic_cast<const ppl::external_sort<std::string, by_first_letter>&>(*p.get_node(sort));
+		while (!p.step()) {
+			REQUIRE(node.runs() < 3);
+		}
+		std::stable_sort(values.begin(), values.end(), by_first_letter());
+		REQUIRE(sorted == values);
+		REQUIRE_FALSE(node.spill_failed());
+	}
+
+	SECTION("A run or a merge that cannot be written leaves its values where they were") {
+		auto random = std::mt19937(6771);
+		auto values = std::vector<int>(1000);
+		for (auto& value: values) {
+			value = static_cast<int>(random() % 500);
+		}
+		// Three runs of 64 values are written, and the fourth fails; or two runs are written, and
+		// merging them fails partway, leaving what was merged and the rest of both
+		for (const auto max_runs: {std::size_t{64}, std::size_t{2}}) {
+			ppl::spill_codec<flaky>::writes_left = 200;
+			ppl::pipeline p;
+			auto sorted = std::vector<flaky>();
+			const auto sort =
+			   p.create_node<ppl::external_sort<flaky>>(64 * sizeof(flaky), std::less<flaky>(), max_runs);
+			p.connect(p.create_node<flaky_source>(values), sort, 0);
+			p.connect(sort, p.create_node<vector_sink<flaky>>(sorted), 0);
+			p.run();
+
+			auto expected = std::vector<flaky>();
+			for (const auto value: values) {
+				expected.push_back({value});
+			}
+			std::sort(expected.begin(), expected.end());
+			REQUIRE(sorted == expected);
+			const auto& node = dynamic_cast<const ppl::external_sort<flaky>&>(*p.get_node(sort));
+			REQUIRE(node.spill_failed());
+			REQUIRE(node.runs() == 3);
+		}
+	}
+}
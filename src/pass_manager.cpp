@@ -0,0 +1,44 @@
+#include "./pass_manager.h"
+
+#include <utility>
+
+namespace ppl {
+	auto pass_manager::standard() -> pass_manager {
+		auto manager = pass_manager();
+		manager.add_common_subexpression_elimination().add_constant_folding().add_dead_node_elimination();
+		return manager;
+	}
+	auto pass_manager::add(std::string name, pass run) -> pass_manager& {
+		passes_.emplace_back(std::move(name), std::move(run));
+		return *this;
+	}
+	auto pass_manager::add_common_subexpression_elimination() -> pass_manager& {
+		return add("common-subexpression-elimination", [](pipeline& p) {
+			return p.eliminate_common_subexpressions();
+		});
+	}
+	auto pass_manager::add_constant_folding() -> pass_manager& {
+		return add("constant-folding", [](pipeline& p) {
+			return p.fold_constants();
+		});
+	}
+	auto pass_manager::add_dead_node_elimination() -> pass_manager& {
+		return add("dead-node-elimination", [](pipeline& p) {
+			return p.eliminate_dead_nodes();
+		});
+	}
+	auto pass_manager::run(pipeline& p) const -> std::vector<pass_result> {
+		const auto was_valid = p.is_valid();
+		std::vector<pass_result> results;
+		for (const auto& [name, run]: passes_) {
+			const auto start = std::chrono::steady_clock::now();
+			const auto changed = run(p);
+			const auto elapsed = std::chrono::steady_clock::now() - start;
+			results.push_back({name, changed, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed)});
+			if (was_valid && !p.is_valid()) {
+				throw pipeline_error(pipeline_error_kind::invalid_after_pass);
+			}
+		}
+		return results;
+	}
+}
@@ -0,0 +1,47 @@
+#ifndef COMP6771_PASS_MANAGER_H
+#define COMP6771_PASS_MANAGER_H
+
+#include "./pipeline.h"
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace ppl {
+	// What a single pass did to a pipeline.
+	struct pass_result {
+		std::string name;
+		// The number of nodes the pass changed.
+		std::size_t changed = 0;
+		std::chrono::nanoseconds elapsed{0};
+	};
+
+	// Runs a sequence of graph-rewriting passes over a pipeline before it is stepped,
+	// and reports the timing and effect of each one.
+	class pass_manager {
+	 public:
+		// A pass rewrites the pipeline, and returns the number of nodes it changed.
+		using pass = std::function<std::size_t(pipeline&)>;
+
+		pass_manager() = default;
+
+		// Common-subexpression elimination, constant folding, then dead-node elimination.
+		[[nodiscard]] static auto standard() -> pass_manager;
+
+		auto add(std::string name, pass run) -> pass_manager&;
+		auto add_common_subexpression_elimination() -> pass_manager&;
+		auto add_constant_folding() -> pass_manager&;
+		auto add_dead_node_elimination() -> pass_manager&;
+
+		// Run every pass in order. If the pipeline was valid to start with and a pass leaves it
+		// invalid, throws `pipeline_error_kind::invalid_after_pass` without running the later passes.
+		auto run(pipeline& p) const -> std::vector<pass_result>;
+
+	 private:
+		std::vector<std::pair<std::string, pass>> passes_;
+	};
+}
+
+#endif  // COMP6771_PASS_MANAGER_H
@@ -0,0 +1,178 @@
+#include "./pass_manager.h"
+
+#include <catch2/catch.hpp>
+#include <sstream>
+
+// Declare some example components
+struct pure_source: ppl::source<int> {
+	static constexpr bool is_pure = true;
+
+	int current_value = 0;
+	int bound;
+
+	explicit pure_source(int bound): bound(bound) {};
+
+	auto operator==(const pure_source& other) const -> bool {
+		return bound == other.bound;
+	}
+
+	auto name() const -> std::string override {
+		return "PureSource: Bound = " + std::to_string(bound);
+	}
+
+	auto poll_next() -> ppl::poll override {
+		if (current_value >= bound)
+			return ppl::poll::closed;
+		++current_value;
+		return ppl::poll::ready;
+	}
+
+	auto value() const -> const int& override {
+		return current_value;
+	}
+};
+
+struct constant_source: ppl::source<int> {
+	int current_value;
+
+	explicit constant_source(int value): current_value(value) {};
+
+	auto name() const -> std::string override {
+		return "ConstantSource";
+	}
+
+	auto version() const noexcept -> std::optional<std::uint64_t> override {
+		return 0;
+	}
+
+	auto poll_next() -> ppl::poll override {
+		return ppl::poll::ready;
+	}
+
+	auto value() const -> const int& override {
+		return current_value;
+	}
+};
+
+struct pure_add: ppl::component<std::tuple<int, int>, int> {
+	static constexpr bool is_pure = true;
+
+	const ppl::producer<int>* slot0 = nullptr;
+	const ppl::producer<int>* slot1 = nullptr;
+	int current_value = 0;
+
+	auto operator==(const pure_add&) const -> bool {
+		return true;
+	}
+
+	auto name() const -> std::string override {
+		return "PureAdd";
+	}
+
+	void connect(const ppl::node* src, int slot) override {
+		if (slot == 0) {
+			slot0 = dynamic_cast<const ppl::producer<int>*>(src);
+		} else if (slot == 1) {
+			slot1 = dynamic_cast<const ppl::producer<int>*>(src);
+		}
+	}
+
+	auto poll_next() -> ppl::poll override {
+		current_value = slot0->value() + slot1->value();
+		return ppl::poll::ready;
+	}
+
+	auto value() const -> const int& override {
+		return current_value;
+	}
+};
+
+struct stream_sink: ppl::sink<int> {
+	const ppl::producer<int>* slot0 = nullptr;
+	std::stringstream& stream;
+
+	explicit stream_sink(std::stringstream& stream): stream(stream) {};
+
+	auto name() const -> std::string override {
+		return "StreamSink";
+	}
+
+	void connect(const ppl::node* src, int slot) override {
+		if (slot == 0) {
+			slot0 = dynamic_cast<const ppl::producer<int>*>(src);
+		}
+	}
+
+	auto poll_next() -> ppl::poll override {
+		stream << slot0->value() << ' ';
+		return ppl::poll::ready;
+	}
+};
+
+TEST_CASE("Test Case 1: The standard passes run in order, and report what they changed") {
+	ppl::pipeline p;
+	const int source1 = p.create_node<pure_source>(3);
+	const int source2 = p.create_node<pure_source>(3);
+	const int offset = p.create_node<constant_source>(100);
+	const int add = p.create_node<pure_add>();
+	std::stringstream stream1;
+	std::stringstream stream2;
+	const int sink1 = p.create_node<stream_sink>(stream1);
+	const int sink2 = p.create_node<stream_sink>(stream2);
+
+	REQUIRE_NOTHROW(p.connect(source1, add, 0));
+	REQUIRE_NOTHROW(p.connect(offset, add, 1));
+	REQUIRE_NOTHROW(p.connect(add, sink1, 0));
+	REQUIRE_NOTHROW(p.connect(source2, sink2, 0));
+	// Source2 is a copy of source1, so the two halves are one pipeline once they are merged
+	REQUIRE_FALSE(p.is_valid());
+
+	const auto results = ppl::pass_manager::standard().run(p);
+	REQUIRE(results.size() == 3);
+	REQUIRE(results[0].name == "common-subexpression-elimination");
+	REQUIRE(results[0].changed == 1);
+	REQUIRE(results[1].name == "constant-folding");
+	REQUIRE(results[1].changed == 1);
+	REQUIRE(results[2].name == "dead-node-elimination");
+	REQUIRE(results[2].changed == 0);
+	REQUIRE(p.get_node(source2) == nullptr);
+	REQUIRE(p.is_valid());
+
+	// Running them again changes nothing
+	for (const auto& result: ppl::pass_manager::standard().run(p)) {
+		REQUIRE(result.changed == 0);
+	}
+
+	p.run();
+	REQUIRE(stream1.str() == "101 102 103 ");
+	REQUIRE(stream2.str() == "1 2 3 ");
+	REQUIRE(p.stats(offset).polls == 1);
+}
+
+TEST_CASE("Test Case 2: A pass that breaks a valid pipeline is reported, and later passes do not run") {
+	ppl::pipeline p;
+	const int source = p.create_node<pure_source>(3);
+	std::stringstream stream;
+	const int sink = p.create_node<stream_sink>(stream);
+	REQUIRE_NOTHROW(p.connect(source, sink, 0));
+	REQUIRE(p.is_valid());
+
+	bool ran_after = false;
+	auto manager = ppl::pass_manager();
+	manager.add("disconnect-everything", [&](ppl::pipeline& pipeline) {
+		pipeline.disconnect(source, sink);
+		return std::size_t{2};
+	}).add("after", [&](ppl::pipeline&) {
+		ran_after = true;
+		return std::size_t{0};
+	});
+
+	try {
+		manager.run(p);
+		REQUIRE(false);
+	} catch (ppl::pipeline_error &e) {
+		REQUIRE(e.kind() == ppl::pipeline_error_kind::invalid_after_pass);
+		REQUIRE(std::string(e.what()) == "invalid after pass");
+	}
+	REQUIRE_FALSE(ran_after);
+}
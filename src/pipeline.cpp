@@ -1,6 +1,17 @@
 #include "./pipeline.h"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <sstream>
+#include <thread>
+#include <utility>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 /**
  * Exceptions
@@ -19,24 +30,358 @@ namespace ppl {
 				return "slot already used";
 			case pipeline_error_kind::connection_type_mismatch:
 				return "connection type mismatch";
+			case pipeline_error_kind::invalid_after_pass:
+				return "invalid after pass";
+			case pipeline_error_kind::spill_failed:
+				return "spill file failed";
 		    default:
 			    return "unknown pipeline error";
 		}
 	}
 }
 
+/**
+ * Spill files
+ */
+namespace ppl {
+	spill_file::~spill_file() {
+		if (file_ != nullptr) {
+			std::fclose(file_);
+		}
+	}
+	auto spill_file::open() noexcept -> bool {
+		if (file_ == nullptr) {
+			file_ = std::tmpfile();
+		}
+		return file_ != nullptr;
+	}
+	void spill_file::write(const void* data, std::size_t size) {
+		// Switching from reading to writing needs a seek, which also flushes what was read ahead
+		if (position_ != position::writing) {
+			if (file_ == nullptr || std::fseek(file_, write_offset_, SEEK_SET) != 0) {
+				throw pipeline_error(pipeline_error_kind::spill_failed);
+			}
+			position_ = position::writing;
+		}
+		const auto written = std::fwrite(data, 1, size, file_);
+		write_offset_ += static_cast<long>(written);
+		if (written != size) {
+			throw pipeline_error(pipeline_error_kind::spill_failed);
+		}
+	}
+	void spill_file::read(void* data, std::size_t size) {
+		if (size > unread()) {
+			throw pipeline_error(pipeline_error_kind::spill_failed);
+		}
+		// Switching from writing to reading needs a seek, which also flushes what was written
+		if (position_ != position::reading) {
+			if (std::fseek(file_, read_offset_, SEEK_SET) != 0) {
+				throw pipeline_error(pipeline_error_kind::spill_failed);
+			}
+			position_ = position::reading;
+		}
+		const auto got = std::fread(data, 1, size, file_);
+		read_offset_ += static_cast<long>(got);
+		if (got != size) {
+			throw pipeline_error(pipeline_error_kind::spill_failed);
+		}
+	}
+	auto spill_file::unread() const noexcept -> std::size_t {
+		return static_cast<std::size_t>(write_offset_ - read_offset_);
+	}
+	void spill_file::reset() noexcept {
+		read_offset_ = 0;
+		write_offset_ = 0;
+		position_ = position::unknown;
+	}
+}
+
+/**
+ * Batch controller
+ */
+namespace ppl {
+	batch_controller::batch_controller(batch_policy policy)
+	: policy_(policy), batch_size_(std::max<std::size_t>(policy.min_batch, 1)) {
+		latencies_.reserve(policy_.window);
+	}
+	void batch_controller::record(std::size_t values,
+	                              std::chrono::nanoseconds latency,
+	                              std::chrono::steady_clock::time_point now) {
+		if (latencies_.empty()) {
+			window_start_ = now - latency;
+		}
+		latencies_.push_back(latency);
+		values_ += values;
+		if (latencies_.size() < std::max<std::size_t>(policy_.window, 1)) {
+			return;
+		}
+
+		// The 99th percentile of the batch latencies in this window
+		auto p99 = latencies_.begin() + static_cast<long>((latencies_.size() - 1) * 99 / 100);
+		std::nth_element(latencies_.begin(), p99, latencies_.end());
+		const auto elapsed = std::chrono::duration<double>(now - window_start_).count();
+		const auto throughput = elapsed > 0 ? static_cast<double>(values_) / elapsed : 0.0;
+
+		if (*p99 * 10 >= policy_.latency_target * 9) {
+			ceiling_ = batch_size_;
+			held_windows_ = 0;
+			batch_size_ = std::max(policy_.min_batch, batch_size_ / 2);
+			best_throughput_ = 0;
+		} else {
+			if (ceiling_ != std::numeric_limits<std::size_t>::max() && ++held_windows_ >= policy_.hold_windows) {
+				ceiling_ = std::numeric_limits<std::size_t>::max();
+			}
+			const auto grown = std::min(policy_.max_batch, batch_size_ * 2);
+			if (throughput > best_throughput_ && grown < ceiling_) {
+				batch_size_ = grown;
+				best_throughput_ = throughput;
+			}
+		}
+		latencies_.clear();
+		values_ = 0;
+	}
+	auto batch_controller::batch_size() const noexcept -> std::size_t {
+		return batch_size_;
+	}
+}
+
 /**
  * Pipeline
  */
 namespace ppl {
+	namespace {
+		// Marks the current thread as the one changing the graph, for as long as it is in scope.
+		class mutator_scope {
+		 public:
+			explicit mutator_scope(std::atomic<std::thread::id>& mutator) noexcept: mutator_(mutator) {
+				mutator_ = std::this_thread::get_id();
+			}
+			mutator_scope(const mutator_scope&) = delete;
+			auto operator=(const mutator_scope&) -> mutator_scope& = delete;
+			~mutator_scope() {
+				mutator_ = std::thread::id();
+			}
+
+		 private:
+			std::atomic<std::thread::id>& mutator_;
+		};
+
+		// Calls `undo` when it goes out of scope, whether by returning or by an exception.
+		template <typename Undo>
+		class scope_exit {
+		 public:
+			explicit scope_exit(Undo undo) noexcept: undo_(std::move(undo)) {}
+			scope_exit(const scope_exit&) = delete;
+			auto operator=(const scope_exit&) -> scope_exit& = delete;
+			~scope_exit() {
+				undo_();
+			}
+
+		 private:
+			Undo undo_;
+		};
+	}
+	template <typename Change>
+	void pipeline::mutate(Change&& change) const {
+		// A change made from within another one is part of it
+		if (mutator_ == std::this_thread::get_id()) {
+			change();
+			return;
+		}
+		const auto serial = std::lock_guard(mutation_mutex_);
+		const auto scope = mutator_scope(mutator_);
+		const auto exclusive = [this] {
+			++pending_mutations_;
+			auto lock = std::unique_lock(graph_mutex_);
+			--pending_mutations_;
+			return lock;
+		};
+		// A change that throws has put the graph back as it was, but may have erased nodes it created
+		// on the way, which are reclaimed all the same
+		auto failure = std::exception_ptr();
+		{
+			const auto lock = exclusive();
+			try {
+				change();
+			} catch (...) {
+				failure = std::current_exception();
+			}
+			if (!running_) {
+				// The next step rebuilds the plan itself
+				plan_.reset();
+				for (auto node: std::exchange(erased_, {})) {
+					delete node;
+				}
+				if (failure) {
+					std::rethrow_exception(failure);
+				}
+				return;
+			}
+		}
+		// Steps only read the shape of the graph, so they go on with the current plan while
+		// the next one is built, and it is swapped in between two of them
+		auto next = build_plan();
+		{
+			const auto lock = exclusive();
+			plan_ = std::move(next);
+		}
+		// Every step from now on starts from the new plan, which cannot reach the erased nodes
+		for (auto node: std::exchange(erased_, {})) {
+			delete node;
+		}
+		if (failure) {
+			std::rethrow_exception(failure);
+		}
+	}
+	auto pipeline::add_node(node* n) noexcept -> node_id {
+		auto id = node_id();
+		mutate([this, n, &id] {
+			id = current_id++;
+			nodes_.emplace(id, n);
+		});
+		return id;
+	}
+	auto pipeline::reserve_id() noexcept -> node_id {
+		if (mutator_ == std::this_thread::get_id()) {
+			return current_id++;
+		}
+		const auto serial = std::lock_guard(mutation_mutex_);
+		return current_id++;
+	}
+	auto pipeline::add_composite(internal::composite_wiring wiring, const std::function<void(subgraph&)>& build)
+	   -> node_id {
+		auto id = node_id();
+		mutate([this, &wiring, &build, &id] {
+			id = current_id++;
+			auto graph = subgraph(*this, wiring);
+			try {
+				build(graph);
+				const auto unbound = std::any_of(wiring.inputs.begin(), wiring.inputs.end(), [](const auto& input) {
+					return !input.has_value();
+				});
+				if (unbound || (wiring.output_type != typeid(void) && !wiring.output)) {
+					throw pipeline_error(pipeline_error_kind::no_such_slot);
+				}
+			} catch (...) {
+				for (auto member = wiring.members.rbegin(); member != wiring.members.rend(); ++member) {
+					if (get_node(*member) != nullptr || composites_.contains(*member)) {
+						erase_node(*member);
+					}
+				}
+				throw;
+			}
+			composites_.emplace(id, std::move(wiring));
+		});
+		return id;
+	}
+	auto pipeline::resolve_output(pipeline::node_id n_id) const noexcept -> node_id {
+		for (auto composite = composites_.find(n_id); composite != composites_.end() && composite->second.output;
+		     composite = composites_.find(n_id)) {
+			n_id = *composite->second.output;
+		}
+		return n_id;
+	}
+	auto pipeline::resolve_input(pipeline::node_id n_id, int slot) const -> std::pair<node_id, int> {
+		auto composite = composites_.find(n_id);
+		if (composite == composites_.end()) {
+			return {n_id, slot};
+		}
+		const auto& inputs = composite->second.inputs;
+		if (slot < 0 || static_cast<std::size_t>(slot) >= inputs.size() || !inputs[static_cast<std::size_t>(slot)]) {
+			throw pipeline_error(pipeline_error_kind::no_such_slot);
+		}
+		// Bound inputs are resolved as they are bound, so one lookup is enough
+		return *inputs[static_cast<std::size_t>(slot)];
+	}
+	void subgraph::connect(int src, int dst, int slot) {
+		pipeline_.connect(src, dst, slot);
+	}
+	void subgraph::set_buffer(int dst, int slot, std::size_t capacity, overflow on_overflow) {
+		pipeline_.set_buffer(dst, slot, capacity, on_overflow);
+	}
+	void subgraph::bind_input(int slot, int inner, int inner_slot) {
+		if (std::find(wiring_.members.begin(), wiring_.members.end(), inner) == wiring_.members.end()) {
+			throw pipeline_error(pipeline_error_kind::invalid_node_id);
+		}
+		if (slot < 0 || static_cast<std::size_t>(slot) >= wiring_.inputs.size()) {
+			throw pipeline_error(pipeline_error_kind::no_such_slot);
+		}
+		const auto [dst, dst_slot] = pipeline_.resolve_input(inner, inner_slot);
+		const auto types = pipeline_.get_node(dst)->get_input_types();
+		if (dst_slot < 0 || static_cast<std::size_t>(dst_slot) >= types.size()) {
+			throw pipeline_error(pipeline_error_kind::no_such_slot);
+		}
+		if (types[static_cast<std::size_t>(dst_slot)] != wiring_.input_types[static_cast<std::size_t>(slot)]) {
+			throw pipeline_error(pipeline_error_kind::connection_type_mismatch);
+		}
+		wiring_.inputs[static_cast<std::size_t>(slot)] = {dst, dst_slot};
+	}
+	void subgraph::bind_output(int inner) {
+		if (std::find(wiring_.members.begin(), wiring_.members.end(), inner) == wiring_.members.end()) {
+			throw pipeline_error(pipeline_error_kind::invalid_node_id);
+		}
+		const auto src = pipeline_.resolve_output(inner);
+		if (pipeline_.get_node(src)->get_output_type() != wiring_.output_type) {
+			throw pipeline_error(pipeline_error_kind::connection_type_mismatch);
+		}
+		wiring_.output = src;
+	}
+	void pipeline::drop_buffer(node* n, int slot) const {
+		auto buffer = n->buffers_.find(slot);
+		if (buffer == n->buffers_.end()) {
+			return;
+		}
+		if (dropped_buffers_ != nullptr) {
+			dropped_buffers_->push_back(std::move(buffer->second));
+		}
+		n->buffers_.erase(buffer);
+	}
+	auto pipeline::build_plan() const -> internal::plan {
+		auto plan = internal::plan();
+		for (const auto& [id, node]: nodes_) {
+			// Retired nodes are dropped from the plan by the first step, as it may be running
+			if (node->excluded_) {
+				continue;
+			}
+			if (node->get_output_type() == typeid(void)) {
+				plan.roots.emplace_back(id, node);
+			}
+			for (const auto& [dst, slot]: node->dependencies_) {
+				if (get_node(dst)->buffers_.contains(slot)) {
+					plan.feeders.emplace_back(id, node);
+					break;
+				}
+			}
+		}
+		return plan;
+	}
 	pipeline::pipeline(pipeline&& other) noexcept {
 		nodes_ = std::move(other.nodes_);
+		composites_ = std::move(other.composites_);
+		current_id = other.current_id;
+		budget_ = std::exchange(other.budget_, std::make_shared<internal::memory_budget>());
+		prune_closed_ = other.prune_closed_;
 		other.nodes_.clear();
+		other.composites_.clear();
+		other.plan_.reset();
 	}
 	auto pipeline::operator=(pipeline&& other) noexcept -> pipeline& {
 		if (this != &other) {
+			for (auto& [id, node]: nodes_) {
+				delete node;
+			}
+			for (auto node: std::exchange(erased_, {})) {
+				delete node;
+			}
 			nodes_ = std::move(other.nodes_);
+			composites_ = std::move(other.composites_);
+			current_id = other.current_id;
+			budget_ = std::exchange(other.budget_, std::make_shared<internal::memory_budget>());
+			prune_closed_ = other.prune_closed_;
+			plan_.reset();
 			other.nodes_.clear();
+			other.composites_.clear();
+			other.plan_.reset();
 		}
 		return *this;
 	}
@@ -44,26 +389,94 @@ namespace ppl {
 		for (auto& [id, node]: nodes_) {
 			delete node;
 		}
+		for (auto node: erased_) {
+			delete node;
+		}
 	}
 	void pipeline::erase_node(pipeline::node_id n_id) {
-		auto node = get_node(n_id);
-		if (node == nullptr) {
-			throw pipeline_error(pipeline_error_kind::invalid_node_id);
-		}
-		// Update the dependencies list of the node that connected to this node
-		for (auto &[slot, src]: node->connections_) {
-			std::erase_if(get_node(src)->dependencies_, [n_id](auto& item) {
-				return item.first == n_id;
-			});
-		}
-		// Update the connections list of the nodes that this node connected to
-		for (auto &[dst, slot]: node->dependencies_) {
-			get_node(dst)->connections_.erase(slot);
-		}
+		mutate([this, n_id] {
+			if (auto composite = composites_.find(n_id); composite != composites_.end()) {
+				const auto members = composite->second.members;
+				composites_.erase(composite);
+				for (auto member = members.rbegin(); member != members.rend(); ++member) {
+					// Unless already erased on its own
+					if (get_node(*member) != nullptr || composites_.contains(*member)) {
+						erase_node(*member);
+					}
+				}
+				return;
+			}
+			auto node = get_node(n_id);
+			if (node == nullptr) {
+				throw pipeline_error(pipeline_error_kind::invalid_node_id);
+			}
+			// Update the dependencies list of the node that connected to this node
+			for (auto &[slot, src]: node->connections_) {
+				std::erase_if(get_node(src)->dependencies_, [n_id](auto& item) {
+					return item.first == n_id;
+				});
+			}
+			// Update the connections list of the nodes that this node connected to
+			for (auto &[dst, slot]: node->dependencies_) {
+				get_node(dst)->connections_.erase(slot);
+				drop_buffer(get_node(dst), slot);
+			}
 
-		// Delete this node
-		delete node;
-		nodes_.erase(n_id);
+			// Delete this node once no step can reach it
+			node->connections_.clear();
+			node->dependencies_.clear();
+			nodes_.erase(n_id);
+			erased_.push_back(node);
+		});
+	}
+	void pipeline::swap_node(pipeline::node_id n_id, std::unique_ptr<node> replacement,
+	                         const std::function<void(node&)>& transfer) {
+		mutate([this, n_id, &replacement, &transfer] {
+			auto old = get_node(n_id);
+			if (old == nullptr) {
+				throw pipeline_error(pipeline_error_kind::invalid_node_id);
+			}
+			if (replacement->get_input_types() != old->get_input_types()
+			    || replacement->get_output_type() != old->get_output_type()) {
+				throw pipeline_error(pipeline_error_kind::connection_type_mismatch);
+			}
+			transfer(*old);
+
+			// The connections, their buffers and how the node is scheduled belong to the ID
+			auto next = replacement.release();
+			next->connections_ = std::move(old->connections_);
+			next->dependencies_ = std::move(old->dependencies_);
+			next->buffers_ = std::move(old->buffers_);
+			next->batch_size_ = old->batch_size_;
+			next->batch_controller_ = std::move(old->batch_controller_);
+			next->backoff_ = old->backoff_;
+			next->stats_ = old->stats_;
+			next->excluded_ = old->excluded_;
+			next->placement_ = std::move(old->placement_);
+			next->watermark_ = old->watermark_.load();
+			next->input_watermark_ = old->input_watermark_;
+			// Anything folded downstream was computed from the old node
+			next->fold_epoch_ = old->fold_epoch_ + 1;
+			old->connections_.clear();
+			old->dependencies_.clear();
+
+			for (const auto& [slot, src]: next->connections_) {
+				auto buffer = next->buffers_.find(slot);
+				next->connect(buffer != next->buffers_.end() ? buffer->second->as_node() : get_node(src), slot);
+			}
+			for (const auto& [dst, slot]: next->dependencies_) {
+				auto dst_node = get_node(dst);
+				// A buffer copies each value as it is produced, so it never refers back to its producer
+				if (!dst_node->buffers_.contains(slot)) {
+					dst_node->connect(next, slot);
+				}
+			}
+			nodes_[n_id] = next;
+			erased_.push_back(old);
+			// The new node may have more to give than the old one did
+			next->retired_ = old->retired_;
+			rearm_cone(next);
+		});
 	}
 	auto pipeline::get_node(pipeline::node_id n_id) const noexcept -> node* {
 		auto it = nodes_.find(n_id);
@@ -73,50 +486,547 @@ namespace ppl {
 		return it->second;
 	}
 	void pipeline::connect(pipeline::node_id src, pipeline::node_id dst, int slot) const {
-		auto src_node = get_node(src);
-		auto dst_node = get_node(dst);
+		mutate([this, src, dst, slot]() mutable {
+			src = resolve_output(src);
+			std::tie(dst, slot) = resolve_input(dst, slot);
+			auto src_node = get_node(src);
+			auto dst_node = get_node(dst);
+
+			// Check if the both nodes exist
+			if (src_node == nullptr || dst_node == nullptr) {
+				throw pipeline_error(pipeline_error_kind::invalid_node_id);
+			}
+			// Check if the target slot is already in use
+			if (dst_node->connections_.find(slot) != dst_node->connections_.end()) {
+				throw pipeline_error(pipeline_error_kind::slot_already_used);
+			}
+			// Check if the slot is existed
+			if (slot < 0 || static_cast<unsigned long>(slot) >= dst_node->get_input_types().size()) {
+				throw pipeline_error(pipeline_error_kind::no_such_slot);
+			}
+			// Check if the output type of the source node matches the input type of the target node on target slot
+			if (dst_node->get_input_types().at(static_cast<unsigned long>(slot)) != src_node->get_output_type()) {
+				throw pipeline_error(pipeline_error_kind::connection_type_mismatch);
+			}
+			// A node taking values from one input at a time leaves the others waiting in a buffer
+			auto buffer = dst_node->selection() != nullptr ? src_node->make_buffer() : nullptr;
+			if (buffer != nullptr) {
+				buffer->capacity = 1;
+				buffer->budget = budget_;
+				dst_node->connect(buffer->as_node(), slot);
+				dst_node->buffers_.emplace(slot, std::move(buffer));
+			} else {
+				dst_node->connect(src_node, slot);
+			}
+			dst_node->connections_.emplace(slot, src);
+			src_node->dependencies_.emplace_back(dst, slot);
+			// A new input may reopen a node that was closed for good
+			rearm_cone(dst_node);
+		});
+	}
+	void pipeline::disconnect(pipeline::node_id src, pipeline::node_id dst) const {
+		mutate([this, src, dst]() mutable {
+			src = resolve_output(src);
+			if (auto composite = composites_.find(dst); composite != composites_.end()) {
+				auto inner = std::vector<node_id>();
+				for (const auto& input: composite->second.inputs) {
+					if (input && std::find(inner.begin(), inner.end(), input->first) == inner.end()) {
+						inner.push_back(input->first);
+					}
+				}
+				for (const auto id: inner) {
+					disconnect(src, id);
+				}
+				return;
+			}
+			auto src_node = get_node(src);
+			auto dst_node = get_node(dst);
+
+			if (src_node == nullptr || dst_node == nullptr) {
+				throw pipeline_error(pipeline_error_kind::invalid_node_id);
+			}
+			for (auto &[slot, connected_by]: dst_node->connections_) {
+				if (src == connected_by) {
+					dst_node->connect(nullptr, slot);
+					drop_buffer(dst_node, slot);
+				}
+			}
+			std::erase_if(dst_node->connections_, [src](const auto& item) {
+				return item.second == src;
+			});
+			std::erase_if(src_node->dependencies_, [dst](const auto& item) {
+				return item.first == dst;
+			});
+		});
+	}
+	void pipeline::set_buffer(pipeline::node_id dst, int slot, std::size_t capacity, overflow on_overflow) const {
+		mutate([this, dst, slot, capacity, on_overflow]() mutable {
+			std::tie(dst, slot) = resolve_input(dst, slot);
+			auto dst_node = get_node(dst);
+			if (dst_node == nullptr) {
+				throw pipeline_error(pipeline_error_kind::invalid_node_id);
+			}
+			// Only an existing connection can be buffered
+			auto connection = dst_node->connections_.find(slot);
+			if (connection == dst_node->connections_.end()) {
+				throw pipeline_error(pipeline_error_kind::no_such_slot);
+			}
+			auto src_node = get_node(connection->second);
+
+			auto buffer = dst_node->buffers_.find(slot);
+			if (capacity == 0 && dst_node->selection() != nullptr) {
+				// A selecting node leaves its unconsumed inputs waiting in the buffer
+				capacity = 1;
+			}
+			if (capacity == 0) {
+				// Back to lockstep: anything still queued is dropped
+				if (buffer != dst_node->buffers_.end()) {
+					dst_node->connect(src_node, slot);
+					drop_buffer(dst_node, slot);
+				}
+				return;
+			}
+			if (buffer != dst_node->buffers_.end()) {
+				if (on_overflow == overflow::spill && !buffer->second->can_spill()) {
+					throw pipeline_error(pipeline_error_kind::connection_type_mismatch);
+				}
+				buffer->second->capacity = capacity;
+				buffer->second->on_overflow = on_overflow;
+				return;
+			}
+			auto new_buffer = src_node->make_buffer();
+			// The output type of the producer cannot be copied into a queue, or has no spill_codec
+			if (new_buffer == nullptr || (on_overflow == overflow::spill && !new_buffer->can_spill())) {
+				throw pipeline_error(pipeline_error_kind::connection_type_mismatch);
+			}
+			new_buffer->capacity = capacity;
+			new_buffer->on_overflow = on_overflow;
+			new_buffer->budget = budget_;
+			dst_node->connect(new_buffer->as_node(), slot);
+			dst_node->buffers_.emplace(slot, std::move(new_buffer));
+		});
+	}
+	void pipeline::transaction::erase_node(pipeline::node_id n_id) {
+		changes_.push_back({.what = change::kind::erase, .id = n_id});
+	}
+	void pipeline::transaction::connect(pipeline::node_id src, pipeline::node_id dst, int slot) {
+		changes_.push_back({.what = change::kind::connect, .id = src, .dst = dst, .slot = slot});
+	}
+	void pipeline::transaction::disconnect(pipeline::node_id src, pipeline::node_id dst) {
+		changes_.push_back({.what = change::kind::disconnect, .id = src, .dst = dst});
+	}
+	void pipeline::transaction::set_buffer(pipeline::node_id dst, int slot, std::size_t capacity, overflow on_overflow) {
+		changes_.push_back({.what = change::kind::set_buffer, .dst = dst, .slot = slot, .capacity = capacity,
+		                    .on_overflow = on_overflow});
+	}
+	auto pipeline::transaction::size() const noexcept -> std::size_t {
+		return changes_.size();
+	}
+	void pipeline::transaction::commit() {
+		pipeline_.commit(std::exchange(changes_, {}));
+	}
+	namespace {
+		// A node as it was before a transaction changed it.
+		struct saved_node {
+			struct buffer {
+				int slot;
+				internal::edge_buffer* queue;
+				std::size_t capacity;
+				overflow on_overflow;
+			};
+			node* n;
+			std::unordered_map<int, const int> connections;
+			std::vector<std::pair<int, int>> dependencies;
+			std::vector<buffer> buffers;
+		};
+	}
+	void pipeline::commit(std::vector<transaction::change> changes) {
+		mutate([this, &changes] {
+			std::vector<std::pair<node_id, node*>> created;
+			std::unordered_set<node_id> created_ids;
+			std::unordered_map<node_id, saved_node> saved;
+			std::vector<std::unique_ptr<internal::edge_buffer>> dropped;
+			const auto erased = erased_.size();
+
+			// Each node is saved before the first change to it
+			const auto save = [this, &saved, &created_ids](const node_id id) {
+				auto n = get_node(id);
+				if (n == nullptr || created_ids.contains(id) || saved.contains(id)) {
+					return;
+				}
+				auto& entry = saved.emplace(id, saved_node{n, n->connections_, n->dependencies_, {}}).first->second;
+				for (const auto& [slot, buffer]: n->buffers_) {
+					entry.buffers.push_back({slot, buffer.get(), buffer->capacity, buffer->on_overflow});
+				}
+			};
+			// A composite stands for the nodes behind its input slots
+			const auto save_inputs = [this, &save](const node_id id) {
+				auto composite = composites_.find(id);
+				if (composite == composites_.end()) {
+					save(id);
+					return;
+				}
+				for (const auto& input: composite->second.inputs) {
+					if (input) {
+						save(input->first);
+					}
+				}
+			};
+			// An erased node changes its neighbours too, and an erased composite every node in it
+			std::unordered_map<node_id, internal::composite_wiring> saved_composites;
+			const auto save_erased = [this, &save, &saved_composites](const node_id id, const auto& self) -> void {
+				if (auto composite = composites_.find(id); composite != composites_.end()) {
+					saved_composites.try_emplace(id, composite->second);
+					for (const auto member: composite->second.members) {
+						self(member, self);
+					}
+					return;
+				}
+				auto n = get_node(id);
+				if (n == nullptr) {
+					return;
+				}
+				save(id);
+				for (const auto& [slot, src]: n->connections_) {
+					save(src);
+				}
+				for (const auto& [dst, slot]: n->dependencies_) {
+					save(dst);
+				}
+			};
+
+			dropped_buffers_ = &dropped;
+			try {
+				using kind = transaction::change::kind;
+				for (auto& change: changes) {
+					switch (change.what) {
+						case kind::create:
+							created.emplace_back(change.id, change.created.get());
+							created_ids.insert(change.id);
+							nodes_.emplace(change.id, change.created.release());
+							break;
+						case kind::erase:
+							save_erased(change.id, save_erased);
+							erase_node(change.id);
+							break;
+						case kind::connect:
+						case kind::disconnect:
+							save(resolve_output(change.id));
+							save_inputs(change.dst);
+							if (change.what == kind::connect) {
+								connect(change.id, change.dst, change.slot);
+							} else {
+								disconnect(change.id, change.dst);
+							}
+							break;
+						case kind::set_buffer:
+							save_inputs(change.dst);
+							set_buffer(change.dst, change.slot, change.capacity, change.on_overflow);
+							break;
+					}
+				}
+			} catch (...) {
+				dropped_buffers_ = nullptr;
+
+				// Every buffer that may be put back, wherever it is now
+				std::unordered_map<internal::edge_buffer*, std::unique_ptr<internal::edge_buffer>> buffers;
+				for (auto& buffer: dropped) {
+					buffers.emplace(buffer.get(), std::move(buffer));
+				}
+				for (auto& [id, entry]: saved) {
+					for (auto& [slot, buffer]: entry.n->buffers_) {
+						buffers.emplace(buffer.get(), std::move(buffer));
+					}
+					entry.n->buffers_.clear();
+				}
+
+				for (const auto& [id, n]: created) {
+					nodes_.erase(id);
+				}
+				for (auto& [id, wiring]: saved_composites) {
+					composites_.insert_or_assign(id, std::move(wiring));
+				}
+				std::unordered_map<node_id, std::vector<int>> changed_slots;
+				for (auto& [id, entry]: saved) {
+					nodes_.insert_or_assign(id, entry.n);
+					for (const auto& [slot, src]: entry.n->connections_) {
+						changed_slots[id].push_back(slot);
+					}
+					entry.n->connections_ = std::move(entry.connections);
+					entry.n->dependencies_ = std::move(entry.dependencies);
+					for (const auto& [slot, queue, capacity, on_overflow]: entry.buffers) {
+						auto& buffer = entry.n->buffers_.emplace(slot, std::move(buffers.at(queue))).first->second;
+						buffer->capacity = capacity;
+						buffer->on_overflow = on_overflow;
+					}
+				}
+				// Point every input back where it was, once all the nodes are back in place
+				for (auto& [id, entry]: saved) {
+					for (const auto slot: changed_slots[id]) {
+						if (!entry.n->connections_.contains(slot)) {
+							entry.n->connect(nullptr, slot);
+						}
+					}
+					for (const auto& [slot, src]: entry.n->connections_) {
+						auto buffer = entry.n->buffers_.find(slot);
+						entry.n->connect(buffer != entry.n->buffers_.end() ? buffer->second->as_node() : get_node(src), slot);
+					}
+				}
 
-		// Check if the both nodes exist
-		if (src_node == nullptr || dst_node == nullptr) {
+				erased_.resize(erased);
+				for (const auto& [id, n]: created) {
+					delete n;
+				}
+				throw;
+			}
+			dropped_buffers_ = nullptr;
+		});
+	}
+	auto pipeline::buffer_size(pipeline::node_id dst, int slot) const -> std::size_t {
+		std::tie(dst, slot) = resolve_input(dst, slot);
+		auto dst_node = get_node(dst);
+		if (dst_node == nullptr) {
 			throw pipeline_error(pipeline_error_kind::invalid_node_id);
 		}
-		// Check if the target slot is already in use
-		if (dst_node->connections_.find(slot) != dst_node->connections_.end()) {
-			throw pipeline_error(pipeline_error_kind::slot_already_used);
+		auto buffer = dst_node->buffers_.find(slot);
+		if (buffer == dst_node->buffers_.end()) {
+			return 0;
 		}
-		// Check if the slot is existed
-		if (slot < 0 || static_cast<unsigned long>(slot) >= dst_node->get_input_types().size()) {
-			throw pipeline_error(pipeline_error_kind::no_such_slot);
+		return buffer->second->size();
+	}
+	auto pipeline::spill_failed(pipeline::node_id dst, int slot) const -> bool {
+		std::tie(dst, slot) = resolve_input(dst, slot);
+		auto dst_node = get_node(dst);
+		if (dst_node == nullptr) {
+			throw pipeline_error(pipeline_error_kind::invalid_node_id);
 		}
-		// Check if the output type of the source node matches the input type of the target node on target slot
-		if (dst_node->get_input_types().at(static_cast<unsigned long>(slot)) != src_node->get_output_type()) {
-			throw pipeline_error(pipeline_error_kind::connection_type_mismatch);
+		auto buffer = dst_node->buffers_.find(slot);
+		if (buffer == dst_node->buffers_.end()) {
+			return false;
 		}
-		dst_node->connect(src_node, slot);
-		dst_node->connections_.emplace(slot, src);
-		src_node->dependencies_.emplace_back(dst, slot);
+		const auto guard = buffer->second->guard();
+		return buffer->second->spill_failed;
 	}
-	void pipeline::disconnect(pipeline::node_id src, pipeline::node_id dst) const {
+	void pipeline::set_memory_budget(std::size_t bytes) noexcept {
+		budget_->limit = bytes;
+	}
+	auto pipeline::memory_in_use() const noexcept -> std::size_t {
+		return budget_->used;
+	}
+	void pipeline::set_batch_size(pipeline::node_id src, std::size_t batch) const {
 		auto src_node = get_node(src);
-		auto dst_node = get_node(dst);
+		if (src_node == nullptr) {
+			throw pipeline_error(pipeline_error_kind::invalid_node_id);
+		}
+		src_node->batch_size_ = std::max<std::size_t>(batch, 1);
+		src_node->batch_controller_.reset();
+	}
+	void pipeline::set_adaptive_batching(pipeline::node_id src, batch_policy policy) const {
+		auto src_node = get_node(src);
+		if (src_node == nullptr) {
+			throw pipeline_error(pipeline_error_kind::invalid_node_id);
+		}
+		src_node->batch_controller_ = std::make_unique<batch_controller>(policy);
+		src_node->batch_size_ = src_node->batch_controller_->batch_size();
+	}
+	auto pipeline::batch_size(pipeline::node_id src) const -> std::size_t {
+		auto src_node = get_node(src);
+		if (src_node == nullptr) {
+			throw pipeline_error(pipeline_error_kind::invalid_node_id);
+		}
+		return src_node->batch_size_;
+	}
+	void pipeline::set_backoff(pipeline::node_id src, std::optional<backoff_policy> policy) const {
+		auto src_node = get_node(src);
+		if (src_node == nullptr) {
+			throw pipeline_error(pipeline_error_kind::invalid_node_id);
+		}
+		if (policy) {
+			policy->max_skip = std::max<std::size_t>(policy->max_skip, 1);
+		}
+		src_node->backoff_ = policy;
+		src_node->empty_streak_ = 0;
+		src_node->backoff_skip_ = 0;
+		src_node->backoff_remaining_ = 0;
+	}
+	auto pipeline::stats(pipeline::node_id n_id) const -> poll_stats {
+		auto node = get_node(n_id);
+		if (node == nullptr) {
+			throw pipeline_error(pipeline_error_kind::invalid_node_id);
+		}
+		return node->stats_;
+	}
+	void pipeline::set_prune_closed(bool enabled) noexcept {
+		prune_closed_ = enabled;
+		if (!enabled) {
+			for (auto& [id, node]: nodes_) {
+				node->retired_ = false;
+			}
+			plan_.reset();
+		}
+	}
+	void pipeline::rearm(pipeline::node_id n_id) const {
+		auto node = get_node(n_id);
+		if (node == nullptr) {
+			throw pipeline_error(pipeline_error_kind::invalid_node_id);
+		}
+		rearm_cone(node);
+		plan_.reset();
+	}
+	void pipeline::rearm_cone(node* n) const noexcept {
+		if (!n->retired_) {
+			return;
+		}
+		n->retired_ = false;
+		for (const auto& [dst, slot]: n->dependencies_) {
+			rearm_cone(get_node(dst));
+		}
+	}
+	auto pipeline::find_dead_nodes() const -> dead_node_report {
+		// Walk upstream from every sink: whatever is not reached never feeds one
+		std::unordered_map<node_id, bool> reaches_sink;
+		const auto& walk = [this, &reaches_sink](const int dst, auto&& walk) -> void {
+			if (reaches_sink[dst]) {
+				return;
+			}
+			reaches_sink[dst] = true;
+			for (const auto& [slot, src]: get_node(dst)->connections_) {
+				if (!get_node(src)->excluded_) {
+					walk(src, walk);
+				}
+			}
+		};
+		for (const auto& [id, node]: nodes_) {
+			if (node->get_output_type() == typeid(void) && !node->excluded_) {
+				walk(id, walk);
+			}
+		}
 
-		if (src_node == nullptr || dst_node == nullptr) {
+		auto report = dead_node_report();
+		for (const auto& [id, node]: nodes_) {
+			if (!node->excluded_ && !reaches_sink[id]) {
+				report.unreachable.push_back(id);
+				if (node->get_input_types().empty()) {
+					report.stranded_sources.push_back(id);
+				}
+			}
+			const auto connected = !node->connections_.empty() || !node->dependencies_.empty();
+			if (connected && node->stats_.polls == 0 && node->stats_.skipped == 0) {
+				report.never_polled.push_back(id);
+			}
+		}
+		return report;
+	}
+	void pipeline::set_excluded(pipeline::node_id n_id, bool excluded) const {
+		auto node = get_node(n_id);
+		if (node == nullptr) {
 			throw pipeline_error(pipeline_error_kind::invalid_node_id);
 		}
-		for (auto &[slot, connected_by]: dst_node->connections_) {
-			if (src == connected_by) {
-				dst_node->connect(nullptr, slot);
+		node->excluded_ = excluded;
+		// Dependents that were retired because of it can run again
+		if (!excluded) {
+			for (const auto& [dst, slot]: node->dependencies_) {
+				rearm_cone(get_node(dst));
 			}
 		}
-		std::erase_if(dst_node->connections_, [src](const auto& item) {
-			return item.second == src;
-		});
-		std::erase_if(src_node->dependencies_, [dst](const auto& item) {
-			return item.first == dst;
-		});
+		plan_.reset();
+	}
+	auto pipeline::eliminate_dead_nodes() const -> std::size_t {
+		const auto report = find_dead_nodes();
+		for (const auto id: report.unreachable) {
+			get_node(id)->excluded_ = true;
+		}
+		plan_.reset();
+		return report.unreachable.size();
+	}
+	auto pipeline::eliminate_common_subexpressions() -> std::size_t {
+		// In topological order, so that merging two inputs can make their dependents equivalent too
+		std::vector<node_id> kept;
+		std::size_t erased = 0;
+		for (const auto id: topological_order()) {
+			node* candidate = get_node(id);
+			if (candidate->equivalent_ == nullptr) {
+				continue;
+			}
+			const auto same = std::find_if(kept.begin(), kept.end(), [this, candidate](const node_id other) {
+				const node* n = get_node(other);
+				return typeid(*n) == typeid(*candidate) && n->connections_ == candidate->connections_
+				       && candidate->equivalent_(*n, *candidate);
+			});
+			if (same == kept.end()) {
+				kept.push_back(id);
+				continue;
+			}
+
+			// Move every dependent of the duplicate over, keeping its buffers as they were. They are
+			// all recorded first, as disconnecting a dependent drops the buffers on all of its slots
+			struct moved {
+				node_id dst;
+				int slot;
+				std::size_t capacity;
+				overflow on_overflow;
+			};
+			std::vector<moved> dependents;
+			for (const auto& [dst, slot]: candidate->dependencies_) {
+				node* dst_node = get_node(dst);
+				auto buffer = dst_node->buffers_.find(slot);
+				const auto buffered = buffer != dst_node->buffers_.end();
+				dependents.push_back({dst, slot, buffered ? buffer->second->capacity : 0,
+				                      buffered ? buffer->second->on_overflow : overflow::block});
+			}
+			for (const auto& [dst, slot, capacity, on_overflow]: dependents) {
+				if (get_node(dst)->connections_.contains(slot)) {
+					disconnect(id, dst);
+				}
+				connect(*same, dst, slot);
+				set_buffer(dst, slot, capacity, on_overflow);
+			}
+			erase_node(id);
+			++erased;
+		}
+		return erased;
+	}
+	auto pipeline::fold_constants() const -> std::size_t {
+		std::size_t flipped = 0;
+		for (const auto id: topological_order()) {
+			node* n = get_node(id);
+			const auto was_folded = n->folded_;
+			n->folded_version_.reset();
+			if (n->connections_.empty()) {
+				n->folded_ = n->get_input_types().empty() && n->version().has_value();
+			} else {
+				// Values coming through a buffer change as it drains, so they cannot be folded
+				n->folded_ = n->equivalent_ != nullptr && n->buffers_.empty()
+				             && std::all_of(n->connections_.begin(), n->connections_.end(), [this](const auto& item) {
+					                return get_node(item.second)->folded_;
+				                });
+			}
+			if (n->folded_ != was_folded) {
+				++flipped;
+			}
+		}
+		return flipped;
+	}
+	auto pipeline::topological_order() const -> std::vector<node_id> {
+		std::unordered_map<node_id, std::size_t> waiting_on;
+		std::vector<node_id> order;
+		for (const auto& [id, node]: nodes_) {
+			waiting_on[id] = node->connections_.size();
+			if (node->connections_.empty()) {
+				order.push_back(id);
+			}
+		}
+		for (std::size_t i = 0; i < order.size(); ++i) {
+			for (const auto& [dst, slot]: get_node(order[i])->dependencies_) {
+				if (--waiting_on[dst] == 0) {
+					order.push_back(dst);
+				}
+			}
+		}
+		return order;
 	}
 	auto pipeline::get_dependencies(pipeline::node_id src) const -> const std::vector<std::pair<node_id, int>> {
-		auto src_node = get_node(src);
+		auto src_node = get_node(resolve_output(src));
 		if (src_node == nullptr) {
 			throw pipeline_error(pipeline_error_kind::invalid_node_id);
 		}
@@ -125,7 +1035,7 @@ namespace ppl {
 	auto pipeline::is_valid() const noexcept -> bool {
 		bool has_sink = false;
 		bool has_source = false;
-		for (const auto [id, node]: nodes_) {
+		for (const auto& [id, node]: nodes_) {
 			if (node->connections_.size() != node->get_input_types().size()) {
 				return false;
 			}
@@ -170,7 +1080,7 @@ namespace ppl {
 		std::unordered_map<node_id, int> visited;
 
 		// Check if there is a cycle in the pipeline, using DFS
-		for (const auto [id, node]: nodes_) {
+		for (const auto& [id, node]: nodes_) {
 			// Start at all sink nodes
 			if (node->get_output_type() == typeid(void)) {
 				if (has_cycle(id, visited, has_cycle)) {
@@ -199,7 +1109,7 @@ namespace ppl {
 		std::unordered_map<node_id, int> visited_all;
 
 		// Check if there is a sub pipeline in the pipeline, using DFS
-		for (const auto [id, node]: nodes_) {
+		for (const auto& [id, node]: nodes_) {
 			// Start from any node in nodes_ map
 			// And we only do traverse once, if the graph is connected, then all the nodes will be visited
 			// in 1 traverse
@@ -211,43 +1121,638 @@ namespace ppl {
 		}
 		return true;
 	}
+	auto pipeline::folded_version(const node* n) const noexcept -> std::optional<std::uint64_t> {
+		if (n->connections_.empty()) {
+			return n->version();
+		}
+		// The epochs of the inputs only ever grow, so their sum changes whenever one of them does
+		std::uint64_t sum = 0;
+		for (const auto& [slot, src]: n->connections_) {
+			const node* input = get_node(src);
+			if (!input->folded_) {
+				return std::nullopt;
+			}
+			sum += input->fold_epoch_;
+		}
+		return sum;
+	}
+	auto pipeline::is_fold_current(const node* n) const noexcept -> bool {
+		return n->folded_version_.has_value() && n->buffers_.empty() && folded_version(n) == n->folded_version_;
+	}
 	auto pipeline::step() const noexcept -> bool {
-		const auto& polling = [this](const int src, auto& visited, auto&& polling) -> ppl::poll {
+		// Let a change from another thread in first
+		while (pending_mutations_ != 0) {
+			std::this_thread::yield();
+		}
+		const auto shared = std::shared_lock(graph_mutex_);
+		if (!plan_) {
+			plan_ = build_plan();
+		}
+		return step_plan(*plan_, nullptr).all_closed;
+	}
+	auto pipeline::step_plan(internal::plan& plan, const std::unordered_set<node_id>* members) const noexcept
+	   -> internal::step_result {
+		// The buffer on the connection into `slot` of `dst`, if that connection is buffered
+		const auto& buffer_of = [this](const int dst, const int slot) -> internal::edge_buffer* {
+			auto& buffers = get_node(dst)->buffers_;
+			auto it = buffers.find(slot);
+			return it == buffers.end() ? nullptr : it->second.get();
+		};
+
+		const auto& polling = [this, &buffer_of, members](const int src, auto& visited, auto&& polling) -> ppl::poll {
 			if (visited.contains(src)) {
 				return visited[src];
 			}
+			// Another partition's node: whatever it produced is already in a buffer
+			if (members != nullptr && !members->contains(src)) {
+				return poll::empty;
+			}
 
 			node* node = get_node(src);
-			for (const auto& [slot, next_src]: node->connections_) {
-				auto res = polling(next_src, visited, polling);
-				if (res == poll::empty) {
-					visited[src] = ppl::poll::empty;
+			// Erased since the plan was built
+			if (node == nullptr || node->retired_ || node->excluded_) {
+				return poll::closed;
+			}
+			// Created while the pipeline runs, and not connected yet: it waits for its inputs
+			if (!node->input_count_) {
+				node->input_count_ = node->get_input_types().size();
+			}
+			if (node->connections_.size() < *node->input_count_) {
+				visited[src] = poll::empty;
+				return poll::empty;
+			}
+			// Backpressure: a producer is held back while any of its buffered connections is full
+			for (const auto& [dst, slot]: node->dependencies_) {
+				auto buffer = buffer_of(dst, slot);
+				if (buffer == nullptr) {
+					continue;
+				}
+				const auto guard = buffer->guard();
+				if (buffer->full()) {
+					visited[src] = poll::empty;
 					return poll::empty;
 				}
-				if (res == poll::closed) {
-					visited[src] = poll::closed;
-					return poll::closed;
+			}
+
+			auto res = poll::ready;
+			auto selection = node->selection();
+			if (selection != nullptr) {
+				std::fill(selection->states.begin(), selection->states.end(), poll::closed);
+			}
+			for (const auto& [slot, next_src]: node->connections_) {
+				res = polling(next_src, visited, polling);
+				// A buffered slot is ready as long as something is queued on it,
+				// whatever its producer did in this step
+				if (auto buffer = node->buffers_.find(slot); buffer != node->buffers_.end()) {
+					auto& queue = *buffer->second;
+					const auto guard = queue.guard();
+					res = queue.size() != 0 ? poll::ready : queue.closed ? poll::closed : poll::empty;
+				}
+				if (selection != nullptr) {
+					selection->states.at(static_cast<std::size_t>(slot)) = res;
+					continue;
+				}
+				if (res != poll::ready) {
+					break;
+				}
+			}
+			if (selection != nullptr) {
+				// Polled whatever its inputs did
+				res = poll::ready;
+			}
+			if (!node->connections_.empty()) {
+				// The producer's watermark is read first: it is published after the values it came
+				// after, so any of them still queued are seen below
+				auto watermark = final_watermark;
+				for (const auto& [slot, input]: node->connections_) {
+					const auto* input_node = get_node(input);
+					auto mark = input_node != nullptr ? input_node->watermark() : final_watermark;
+					if (auto buffer = node->buffers_.find(slot); buffer != node->buffers_.end()) {
+						const auto guard = buffer->second->guard();
+						mark = buffer->second->front_mark().value_or(mark);
+					}
+					watermark = std::min(watermark, mark);
 				}
+				node->input_watermark_ = std::max(node->input_watermark_, watermark);
 			}
-			visited[src] = node->poll_next();
-			return visited[src];
+			if (res == poll::ready && node->backoff_remaining_ != 0) {
+				// A quiet source sits this step out
+				--node->backoff_remaining_;
+				++node->stats_.skipped;
+				res = poll::empty;
+			} else if (res == poll::ready && node->folded_ && is_fold_current(node)) {
+				// The last value is still the right one
+				++node->stats_.cached;
+			} else if (res == poll::ready) {
+				// Inputs from another thread stay locked until they are consumed. Only the consumer
+				// takes values out, so what was ready above is still there
+				std::vector<std::unique_lock<std::mutex>> guards;
+				for (auto& [slot, buffer]: node->buffers_) {
+					if (buffer->shared) {
+						guards.push_back(buffer->guard());
+					}
+				}
+				const auto start = profiling_ ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+				res = node->poll_next();
+				if (profiling_) {
+					node->stats_.busy += std::chrono::steady_clock::now() - start;
+				}
+				if (node->folded_) {
+					// Only a ready value can be reused in later steps
+					node->folded_version_ = res == poll::ready ? folded_version(node) : std::nullopt;
+					++node->fold_epoch_;
+				}
+				++node->stats_.polls;
+				switch (res) {
+					case poll::ready:
+						++node->stats_.ready;
+						break;
+					case poll::empty:
+						++node->stats_.empty;
+						break;
+					case poll::closed:
+						++node->stats_.closed;
+						break;
+				}
+				// Every queued input has now been consumed, or only those chosen by a selecting node
+				for (auto& [slot, buffer]: node->buffers_) {
+					const auto consumed = selection == nullptr
+					                      || (selection->consumed.at(static_cast<std::size_t>(slot)) && buffer->size() != 0);
+					if (consumed) {
+						buffer->pop();
+						buffer->pop_mark();
+					}
+				}
+				if (selection != nullptr) {
+					std::fill(selection->consumed.begin(), selection->consumed.end(), false);
+				}
+				if (node->backoff_ && node->connections_.empty()) {
+					if (res != poll::empty) {
+						node->empty_streak_ = 0;
+						node->backoff_skip_ = 0;
+					} else if (++node->empty_streak_ >= node->backoff_->threshold) {
+						node->backoff_skip_ = std::clamp<std::size_t>(node->backoff_skip_ * 2, 1, node->backoff_->max_skip);
+						node->backoff_remaining_ = node->backoff_skip_;
+					}
+				}
+			} else if (res == poll::closed) {
+				// Nothing will consume these values any more, so stop them holding back their producers
+				for (auto& [slot, buffer]: node->buffers_) {
+					const auto guard = buffer->guard();
+					buffer->clear();
+					buffer->clear_marks();
+				}
+			}
+
+			// Hand the result on to the buffered connections of this node
+			for (const auto& [dst, slot]: node->dependencies_) {
+				if (auto buffer = buffer_of(dst, slot)) {
+					const auto guard = buffer->guard();
+					if (res == poll::ready) {
+						buffer->push(node);
+						buffer->push_mark(node->watermark_.load(std::memory_order_relaxed));
+						buffer->closed = false;
+					} else if (res == poll::closed) {
+						buffer->closed = true;
+					}
+				}
+			}
+			// Watermarks only ever move forward
+			auto watermark = res == poll::closed ? final_watermark
+			                 : node->own_watermark_.value_or(node->connections_.empty() ? no_watermark
+			                                                                            : node->input_watermark_);
+			if (watermark > node->watermark_.load(std::memory_order_relaxed)) {
+				node->watermark_.store(watermark, std::memory_order_release);
+			}
+			if (res == poll::closed && prune_closed_) {
+				node->retired_ = true;
+			}
+			visited[src] = res;
+			return res;
 		};
 
 		std::unordered_map<node_id, ppl::poll> visited;
 
-		bool is_all_closed = true;
-		for (const auto& [id, node]: nodes_) {
-			if (node->get_output_type() == typeid(void)) {
-				if (polling(id, visited, polling) != poll::closed) {
-					is_all_closed = false;
+		// Let the producers of buffered connections run ahead of their consumers
+		for (const auto& [id, node]: plan.feeders) {
+			const auto buffered = std::count_if(node->dependencies_.begin(), node->dependencies_.end(),
+			                                    [&buffer_of](const auto& item) {
+				                                    return buffer_of(item.first, item.second) != nullptr;
+			                                    });
+			// No longer buffered since the plan was built
+			if (buffered == 0) {
+				continue;
+			}
+			// Only a source that feeds nothing but buffers can be polled again in the same step:
+			// the inputs of a component, or its lockstep dependents, would miss values otherwise
+			const auto batch = node->connections_.empty() && static_cast<std::size_t>(buffered) == node->dependencies_.size()
+			                   ? node->batch_size_ : 1;
+			const auto start = node->batch_controller_ ? std::chrono::steady_clock::now()
+			                                           : std::chrono::steady_clock::time_point();
+			std::size_t values = 0;
+			for (std::size_t i = 0; i < batch; ++i) {
+				visited.erase(id);
+				if (polling(id, visited, polling) != poll::ready) {
+					break;
 				}
+				++values;
+			}
+			if (node->batch_controller_) {
+				const auto now = std::chrono::steady_clock::now();
+				node->batch_controller_->record(values, now - start, now);
+				node->batch_size_ = node->batch_controller_->batch_size();
 			}
 		}
 
-		return is_all_closed;
+		auto result = internal::step_result();
+		for (const auto& [id, node]: plan.roots) {
+			const auto res = polling(id, visited, polling);
+			if (res != poll::closed) {
+				result.all_closed = false;
+				if (node->get_output_type() == typeid(void)) {
+					result.sinks_closed = false;
+				}
+			}
+			if (res == poll::ready) {
+				result.progress = true;
+			}
+		}
+
+		// Retired nodes are left out of the plan, so later steps never start from them again
+		if (prune_closed_) {
+			const auto retired = [](const auto& item) {
+				return item.second->retired_;
+			};
+			std::erase_if(plan.feeders, retired);
+			std::erase_if(plan.roots, retired);
+		}
+
+		return result;
 	}
 	void pipeline::run() const noexcept {
+		running_ = true;
 		while (!step()) {}
+		running_ = false;
+	}
+	void pipeline::set_profiling(bool enabled) noexcept {
+		profiling_ = enabled;
+	}
+	auto pipeline::partition(std::size_t groups) const -> std::vector<std::vector<node_id>> {
+		groups = std::max<std::size_t>(groups, 1);
+		// Without profiling, every node costs the same and every connection carries the same traffic
+		const auto cost = [](const node* n) -> double {
+			return n->stats_.polls == 0 ? 1.0 : std::max(static_cast<double>(n->stats_.busy.count()), 1.0);
+		};
+		const auto traffic = [](const node* src) -> double {
+			return static_cast<double>(std::max<std::size_t>(src->stats_.ready, 1));
+		};
+
+		double total = 0;
+		double heaviest = 0;
+		for (const auto& [id, node]: nodes_) {
+			total += cost(node);
+			heaviest = std::max(heaviest, cost(node));
+		}
+		// Allow each group 10% over an even share
+		const auto capacity = std::max(total / static_cast<double>(groups) * 1.1, heaviest);
+
+		std::unordered_map<node_id, std::size_t> owner;
+		std::vector<double> load(groups, 0.0);
+		// The traffic between `id` and the nodes already in each group
+		const auto affinity = [this, &owner, &traffic, groups](const node_id id) {
+			std::vector<double> result(groups, 0.0);
+			const node* n = get_node(id);
+			for (const auto& [slot, src]: n->connections_) {
+				if (auto it = owner.find(src); it != owner.end()) {
+					result[it->second] += traffic(get_node(src));
+				}
+			}
+			for (const auto& [dst, slot]: n->dependencies_) {
+				if (auto it = owner.find(dst); it != owner.end()) {
+					result[it->second] += traffic(n);
+				}
+			}
+			return result;
+		};
+		// The CPUs each group is pinned to, by the first pinned node placed in it
+		std::vector<std::vector<unsigned>> pins(groups);
+		const auto pinned = [](const node* n) {
+			auto cpus = n->placement_.cpus;
+			std::sort(cpus.begin(), cpus.end());
+			cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+			return cpus;
+		};
+		const auto best_group = [&load, &pins, capacity, groups](const std::vector<double>& gains, const double weight, const std::vector<unsigned>& cpus) {
+			// A worker is pinned to the CPUs of all of its nodes, so keep nodes pinned elsewhere apart
+			const auto agrees = [&pins, &cpus](const std::size_t g) {
+				return cpus.empty() || pins[g].empty() || pins[g] == cpus;
+			};
+			std::size_t best = 0;
+			for (std::size_t g = 1; g < groups; ++g) {
+				if (agrees(g) != agrees(best)) {
+					if (agrees(g)) {
+						best = g;
+					}
+					continue;
+				}
+				const auto fits = load[g] + weight <= capacity;
+				const auto best_fits = load[best] + weight <= capacity;
+				if (fits != best_fits) {
+					if (fits) {
+						best = g;
+					}
+					continue;
+				}
+				if (gains[g] > gains[best] || (gains[g] == gains[best] && load[g] < load[best])) {
+					best = g;
+				}
+			}
+			return best;
+		};
+
+		// Greedily place each node, inputs first, with the group it exchanges the most traffic with
+		auto order = topological_order();
+		// Nodes on a cycle never run, but still belong somewhere
+		for (const auto& [id, node]: nodes_) {
+			if (std::find(order.begin(), order.end(), id) == order.end()) {
+				order.push_back(id);
+			}
+		}
+		// Colocated nodes go wherever the first of them went, and so do nodes pinned to the same CPUs
+		std::unordered_map<node_id, std::size_t> root_group;
+		std::map<std::vector<unsigned>, std::size_t> pin_group;
+		std::unordered_map<node_id, std::size_t> colocated;
+		for (const auto id: order) {
+			++colocated[colocation_root(id)];
+		}
+		for (const auto id: order) {
+			const auto root = colocation_root(id);
+			const auto cpus = pinned(get_node(id));
+			auto g = groups;
+			if (auto it = root_group.find(root); it != root_group.end()) {
+				g = it->second;
+			} else if (auto pin = pin_group.find(cpus); !cpus.empty() && pin != pin_group.end()) {
+				g = pin->second;
+			} else {
+				g = best_group(affinity(id), cost(get_node(id)), cpus);
+			}
+			root_group[root] = g;
+			if (!cpus.empty()) {
+				pin_group.try_emplace(cpus, g);
+				if (pins[g].empty()) {
+					pins[g] = cpus;
+				}
+			}
+			owner[id] = g;
+			load[g] += cost(get_node(id));
+		}
+
+		// Then move single, unpinned nodes wherever that cuts more traffic without overloading a group
+		for (int pass = 0; pass < 2; ++pass) {
+			for (const auto id: order) {
+				if (colocated[colocation_root(id)] > 1 || !get_node(id)->placement_.cpus.empty()) {
+					continue;
+				}
+				const auto weight = cost(get_node(id));
+				const auto from = owner[id];
+				const auto gains = affinity(id);
+				load[from] -= weight;
+				auto to = from;
+				for (std::size_t g = 0; g < groups; ++g) {
+					if (gains[g] > gains[to] && load[g] + weight <= capacity) {
+						to = g;
+					}
+				}
+				owner[id] = to;
+				load[to] += weight;
+			}
+		}
+
+		std::vector<std::vector<node_id>> result(groups);
+		for (const auto& [id, node]: nodes_) {
+			result[owner[id]].push_back(id);
+		}
+		std::erase_if(result, [](const auto& group) {
+			return group.empty();
+		});
+		return result;
+	}
+	namespace {
+		void pin_current_thread([[maybe_unused]] const std::vector<unsigned>& cpus) noexcept {
+#ifdef __linux__
+			cpu_set_t set;
+			CPU_ZERO(&set);
+			for (const auto cpu: cpus) {
+				if (cpu < CPU_SETSIZE) {
+					CPU_SET(cpu, &set);
+				}
+			}
+			pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+		}
+
+		// Parse a list of CPUs such as "0-3,8,10-11".
+		auto parse_cpu_list(const std::string& list) -> std::vector<unsigned> {
+			std::vector<unsigned> cpus;
+			auto in = std::stringstream(list);
+			auto range = std::string();
+			while (std::getline(in, range, ',')) {
+				const auto dash = range.find('-');
+				try {
+					const auto first = static_cast<unsigned>(std::stoul(range.substr(0, dash)));
+					const auto last = dash == std::string::npos ? first : static_cast<unsigned>(std::stoul(range.substr(dash + 1)));
+					for (auto cpu = first; cpu <= last; ++cpu) {
+						cpus.push_back(cpu);
+					}
+				} catch (const std::exception&) {
+					// Not a CPU number: skip it
+				}
+			}
+			return cpus;
+		}
+
+		// The CPUs on the same NUMA node as `cpu`, or only `cpu` where the topology is unknown.
+		auto numa_node_cpus(unsigned cpu) -> std::vector<unsigned> {
+			auto error = std::error_code();
+			for (const auto& entry: std::filesystem::directory_iterator("/sys/devices/system/node", error)) {
+				if (!entry.path().filename().string().starts_with("node")) {
+					continue;
+				}
+				auto list = std::string();
+				std::getline(std::ifstream(entry.path() / "cpulist"), list);
+				auto cpus = parse_cpu_list(list);
+				if (std::find(cpus.begin(), cpus.end(), cpu) != cpus.end()) {
+					return cpus;
+				}
+			}
+			return {cpu};
+		}
+	}
+	void pipeline::set_placement(pipeline::node_id n_id, placement hints) const {
+		auto node = get_node(n_id);
+		if (node == nullptr) {
+			throw pipeline_error(pipeline_error_kind::invalid_node_id);
+		}
+		for (const auto& other: {hints.numa_of, hints.colocate_with}) {
+			if (other && get_node(*other) == nullptr) {
+				throw pipeline_error(pipeline_error_kind::invalid_node_id);
+			}
+		}
+		node->placement_ = std::move(hints);
+	}
+	auto pipeline::get_placement(pipeline::node_id n_id) const -> placement {
+		auto node = get_node(n_id);
+		if (node == nullptr) {
+			throw pipeline_error(pipeline_error_kind::invalid_node_id);
+		}
+		return node->placement_;
+	}
+	auto pipeline::colocation_root(pipeline::node_id n_id) const noexcept -> node_id {
+		// Bounded, in case the hints form a cycle
+		for (std::size_t i = 0; i < nodes_.size(); ++i) {
+			const node* n = get_node(n_id);
+			if (n == nullptr || !n->placement_.colocate_with || get_node(*n->placement_.colocate_with) == nullptr) {
+				break;
+			}
+			n_id = *n->placement_.colocate_with;
+		}
+		return n_id;
+	}
+	void pipeline::run_partitioned(const std::vector<std::vector<node_id>>& groups, std::size_t boundary_capacity) const {
+		// The groups stay fixed for the whole run, so changes from other threads wait until it is over
+		const auto serial = std::lock_guard(mutation_mutex_);
+		const auto scope = mutator_scope(mutator_);
+		std::unordered_map<node_id, std::size_t> owner;
+		for (std::size_t g = 0; g < groups.size(); ++g) {
+			for (const auto id: groups[g]) {
+				if (get_node(id) == nullptr) {
+					throw pipeline_error(pipeline_error_kind::invalid_node_id);
+				}
+				owner[id] = g;
+			}
+		}
+		if (groups.empty()) {
+			run();
+			return;
+		}
+
+		// Colocated nodes run with the node they are colocated with
+		for (const auto& [id, node]: nodes_) {
+			owner[id] = owner[colocation_root(id)];
+		}
+		std::vector<std::unordered_set<node_id>> members(groups.size());
+		for (const auto& [id, node]: nodes_) {
+			members[owner[id]].insert(id);
+		}
+
+		// The CPUs of each worker: those its nodes are pinned to, or those on the NUMA node of another
+		// worker, or else one CPU per worker
+		const auto hardware = std::max(std::thread::hardware_concurrency(), 1U);
+		std::vector<std::vector<unsigned>> cpus(groups.size());
+		for (const auto& [id, node]: nodes_) {
+			auto& group_cpus = cpus[owner[id]];
+			group_cpus.insert(group_cpus.end(), node->placement_.cpus.begin(), node->placement_.cpus.end());
+		}
+		const auto cpus_of = [&cpus, hardware](const std::size_t g) {
+			return cpus[g].empty() ? std::vector<unsigned>{static_cast<unsigned>(g % hardware)} : cpus[g];
+		};
+		for (const auto& [id, node]: nodes_) {
+			if (node->placement_.numa_of && cpus[owner[id]].empty()) {
+				cpus[owner[id]] = numa_node_cpus(cpus_of(owner[*node->placement_.numa_of]).front());
+			}
+		}
+		// Queues only at the boundaries between groups, undone once the run is over, or as soon as
+		// one of them cannot be added
+		std::vector<std::pair<node_id, int>> added;
+		std::vector<std::pair<node_id, int>> marked;
+		const auto undo = scope_exit([this, &added, &marked]() noexcept {
+			for (const auto& [dst, slot]: marked) {
+				get_node(dst)->buffers_.at(slot)->shared = false;
+			}
+			for (const auto& [dst, slot]: added) {
+				try {
+					set_buffer(dst, slot, 0);
+				} catch (...) {
+					// The consumer refused its producer back, so it keeps reading through the buffer
+				}
+			}
+			plan_.reset();
+		});
+		for (const auto& [id, node]: nodes_) {
+			for (const auto& [dst, slot]: node->dependencies_) {
+				if (owner[dst] == owner[id]) {
+					continue;
+				}
+				if (!get_node(dst)->buffers_.contains(slot)) {
+					set_buffer(dst, slot, std::max<std::size_t>(boundary_capacity, 1));
+					added.emplace_back(dst, slot);
+				}
+				auto& buffer = *get_node(dst)->buffers_.at(slot);
+				if (!buffer.shared) {
+					buffer.shared = true;
+					marked.emplace_back(dst, slot);
+				}
+			}
+		}
+
+		std::vector<internal::plan> plans(groups.size());
+		std::atomic<std::size_t> open_groups = 0;
+		for (const auto& [id, node]: nodes_) {
+			if (node->retired_ || node->excluded_) {
+				continue;
+			}
+			auto& plan = plans[owner[id]];
+			const auto crosses = std::any_of(node->dependencies_.begin(), node->dependencies_.end(),
+			                                 [&owner, id](const auto& item) {
+				                                 return owner[item.first] != owner[id];
+			                                 });
+			if (node->get_output_type() == typeid(void) || crosses) {
+				plan.roots.emplace_back(id, node);
+			}
+			const auto feeds_buffer = std::any_of(node->dependencies_.begin(), node->dependencies_.end(),
+			                                      [this, &owner, id](const auto& item) {
+				                                      return owner[item.first] == owner[id]
+				                                             && get_node(item.first)->buffers_.contains(item.second);
+			                                      });
+			if (feeds_buffer) {
+				plan.feeders.emplace_back(id, node);
+			}
+		}
+		// The groups that still have an open sink; once there are none, every worker stops
+		std::vector<bool> has_sink(groups.size(), false);
+		for (std::size_t g = 0; g < groups.size(); ++g) {
+			has_sink[g] = std::any_of(plans[g].roots.begin(), plans[g].roots.end(), [](const auto& item) {
+				return item.second->get_output_type() == typeid(void);
+			});
+			if (has_sink[g]) {
+				++open_groups;
+			}
+		}
+
+		{
+			std::vector<std::jthread> workers;
+			for (std::size_t g = 0; g < groups.size(); ++g) {
+				const auto sinks = static_cast<bool>(has_sink[g]);
+				workers.emplace_back([this, g, &plans, &members, &open_groups, sinks_open = sinks,
+				                      worker_cpus = cpus_of(g)]() mutable {
+					pin_current_thread(worker_cpus);
+					while (open_groups.load() != 0) {
+						const auto result = step_plan(plans[g], &members[g]);
+						// This group may still have to feed the others after its own sinks are closed
+						if (sinks_open && result.sinks_closed) {
+							sinks_open = false;
+							--open_groups;
+						}
+						if (result.all_closed) {
+							break;
+						}
+						if (!result.progress) {
+							std::this_thread::yield();
+						}
+					}
+				});
+			}
+		}
 	}
 	std::ostream& operator<<(std::ostream& ostream, const pipeline& pipeline) {
 		ostream << "digraph G {\n";
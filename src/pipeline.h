@@ -1,10 +1,28 @@
 #ifndef COMP6771_PIPELINE_H
 #define COMP6771_PIPELINE_H
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
 #include <exception>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <memory>
 #include <string>
 #include <unordered_map>
 #include <map>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <span>
+#include <thread>
+#include <unordered_set>
 #include <vector>
 #include <typeindex>
 
@@ -19,6 +37,10 @@ namespace ppl {
 		slot_already_used,
 		// The output type and input types for a connection don't match.
 		connection_type_mismatch,
+		// A graph-rewriting pass turned a valid pipeline into an invalid one.
+		invalid_after_pass,
+		// A spill file could not be written, or held less than was read from it.
+		spill_failed,
 	};
 
 	struct pipeline_error: std::exception {
@@ -41,11 +63,313 @@ namespace ppl {
 		closed,
 	};
 
+	// What a buffered connection does with a value that does not fit in its capacity.
+	enum class overflow {
+		// Stop polling the producer until the consumer catches up.
+		block,
+		// Write the value to a temporary file, and read it back in order later.
+		spill,
+	};
+
+	// A temporary file used as a FIFO of bytes by a spilling buffer. The file is only repositioned
+	// when a write follows a read or the other way round, so a run of either goes through the stdio
+	// buffer. Both throw `pipeline_error_kind::spill_failed` if the bytes cannot be written or read.
+	class spill_file {
+	 public:
+		spill_file() = default;
+		spill_file(const spill_file&) = delete;
+		auto operator=(const spill_file&) -> spill_file& = delete;
+		~spill_file();
+
+		// Create the file on first use. Returns false if no temporary file could be created.
+		auto open() noexcept -> bool;
+		void write(const void* data, std::size_t size);
+		void read(void* data, std::size_t size);
+		// The number of bytes written but not read yet.
+		[[nodiscard]] auto unread() const noexcept -> std::size_t;
+		// Forget everything written so far, and reuse the file from the start.
+		void reset() noexcept;
+
+	 private:
+		enum class position { unknown, writing, reading };
+
+		std::FILE* file_ = nullptr;
+		long read_offset_ = 0;
+		long write_offset_ = 0;
+		position position_ = position::unknown;
+	};
+
+	// How a value of type `T` is written to and read back from a spill file.
+	// Specialise this for any other type that should be able to spill.
+	template <typename T>
+	struct spill_codec;
+
+	template <typename T>
+	requires std::is_trivially_copyable_v<T>
+	struct spill_codec<T> {
+		static void write(spill_file& file, const T& value) {
+			file.write(&value, sizeof(T));
+		}
+		static auto read(spill_file& file) -> T {
+			auto bytes = std::array<std::byte, sizeof(T)>();
+			file.read(bytes.data(), bytes.size());
+			return std::bit_cast<T>(bytes);
+		}
+	};
+
+	// A codec may also give `size(value)`, the memory a value holds with everything it owns, which
+	// the memory budget counts instead of `sizeof(T)`.
+	template <>
+	struct spill_codec<std::string> {
+		static auto size(const std::string& value) noexcept -> std::size_t {
+			return sizeof(std::string) + value.size();
+		}
+		static void write(spill_file& file, const std::string& value) {
+			const auto size = static_cast<std::uint64_t>(value.size());
+			file.write(&size, sizeof(size));
+			file.write(value.data(), value.size());
+		}
+		static auto read(spill_file& file) -> std::string {
+			auto size = std::uint64_t{0};
+			file.read(&size, sizeof(size));
+			// A size the file cannot hold was never written whole
+			if (size > file.unread()) {
+				throw pipeline_error(pipeline_error_kind::spill_failed);
+			}
+			auto value = std::string(static_cast<std::size_t>(size), '\0');
+			file.read(value.data(), value.size());
+			return value;
+		}
+	};
+
+	class node;
+
+	// The watermark of a stream that has promised nothing about its event times yet, and that of a
+	// stream that has ended.
+	inline constexpr auto no_watermark = std::numeric_limits<std::int64_t>::min();
+	inline constexpr auto final_watermark = std::numeric_limits<std::int64_t>::max();
+
+	namespace internal {
+		template <typename T>
+		concept spillable = requires(spill_file& file, const T& value) {
+			spill_codec<T>::write(file, value);
+			{ spill_codec<T>::read(file) } -> std::same_as<T>;
+		};
+
+		// The memory a queued value counts against the memory budget.
+		template <typename T>
+		auto footprint(const T& value) noexcept -> std::size_t {
+			if constexpr (requires { { spill_codec<T>::size(value) } -> std::convertible_to<std::size_t>; }) {
+				return spill_codec<T>::size(value);
+			} else {
+				return sizeof(T);
+			}
+		}
+
+		// The memory held by all the buffers of a pipeline.
+		struct memory_budget {
+			std::size_t limit = std::numeric_limits<std::size_t>::max();
+			std::atomic<std::size_t> used = 0;
+		};
+
+		// A bounded FIFO queue sitting on a single connection.
+		// The consumer is connected to the buffer instead of the producer,
+		// and reads the oldest queued value through it.
+		struct edge_buffer {
+			virtual ~edge_buffer() {
+				clear_marks();
+			}
+			// Copy the current value of `src` to the back of the queue.
+			virtual void push(const node* src) = 0;
+			virtual void pop() = 0;
+			virtual void clear() noexcept = 0;
+			[[nodiscard]] virtual auto size() const noexcept -> std::size_t = 0;
+			[[nodiscard]] virtual auto can_spill() const noexcept -> bool = 0;
+			// The buffer as seen by the consumer's `connect()`.
+			[[nodiscard]] virtual auto as_node() const noexcept -> const node* = 0;
+
+			// A spilling buffer never holds its producer back.
+			[[nodiscard]] auto full() const noexcept -> bool {
+				return on_overflow == overflow::block && size() >= capacity;
+			}
+			// Locks the buffer if its producer and consumer run on different threads.
+			[[nodiscard]] auto guard() -> std::unique_lock<std::mutex> {
+				return shared ? std::unique_lock(lock) : std::unique_lock<std::mutex>();
+			}
+
+			// The watermark of the producer before each queued value, oldest first. A watermark
+			// rarely changes, so equal marks are kept as a single run, and only each run counts
+			// against the memory budget.
+			struct mark_run {
+				std::int64_t mark;
+				std::size_t count;
+			};
+			void push_mark(std::int64_t mark) {
+				if (!marks_.empty() && marks_.back().mark == mark) {
+					++marks_.back().count;
+					return;
+				}
+				marks_.push_back({mark, 1});
+				budget->used += sizeof(mark_run);
+			}
+			// The mark of the oldest queued value, if any.
+			[[nodiscard]] auto front_mark() const noexcept -> std::optional<std::int64_t> {
+				return marks_.empty() ? std::nullopt : std::optional(marks_.front().mark);
+			}
+			void pop_mark() noexcept {
+				if (!marks_.empty() && --marks_.front().count == 0) {
+					marks_.pop_front();
+					budget->used -= sizeof(mark_run);
+				}
+			}
+			// Forget the marks of the `count` newest values.
+			void drop_marks(std::size_t count) noexcept {
+				while (count != 0 && !marks_.empty()) {
+					const auto dropped = std::min(count, marks_.back().count);
+					count -= dropped;
+					if ((marks_.back().count -= dropped) == 0) {
+						marks_.pop_back();
+						budget->used -= sizeof(mark_run);
+					}
+				}
+			}
+			void clear_marks() noexcept {
+				if (budget != nullptr) {
+					budget->used -= marks_.size() * sizeof(mark_run);
+				}
+				marks_.clear();
+			}
+
+			std::size_t capacity = 0;
+			overflow on_overflow = overflow::block;
+			std::shared_ptr<memory_budget> budget;
+			// Set when the producer closes; the buffer reports closed once drained.
+			bool closed = false;
+			// Set when the spill file could not be written or read back. The buffer stops spilling
+			// and keeps what it is given in memory from then on.
+			bool spill_failed = false;
+			bool shared = false;
+			std::mutex lock;
+
+		 private:
+			std::deque<mark_run> marks_;
+		};
+	}
+
+	namespace internal {
+		// The inputs of a node that takes values from them one at a time: what each of them had
+		// in the current step, and which of them the node took a value from.
+		struct input_selection {
+			std::vector<poll> states;
+			std::vector<bool> consumed;
+		};
+	}
+
+	// Bounds and target for a batch size tuned at runtime by a `batch_controller`.
+	struct batch_policy {
+		std::size_t min_batch = 1;
+		std::size_t max_batch = 1024;
+		// The p99 time to produce a single batch should stay under this.
+		std::chrono::nanoseconds latency_target = std::chrono::milliseconds(1);
+		// The number of batches observed before each decision.
+		std::size_t window = 64;
+		// The number of windows within the target before a batch size that missed it is tried again.
+		std::size_t hold_windows = 16;
+	};
+
+	// Tunes a batch size from the observed latency of each batch and the overall throughput:
+	// batches double while throughput improves and the latency target holds,
+	// and halve as soon as the p99 latency comes within 10% of the target.
+	// A batch size that missed the target is a ceiling for the next `hold_windows` windows,
+	// so the size settles below it rather than going back and forth across it.
+	class batch_controller {
+	 public:
+		explicit batch_controller(batch_policy policy);
+
+		// Record a batch of `values` that took `latency` to produce, and finished at `now`.
+		void record(std::size_t values, std::chrono::nanoseconds latency, std::chrono::steady_clock::time_point now);
+		[[nodiscard]] auto batch_size() const noexcept -> std::size_t;
+
+	 private:
+		batch_policy policy_;
+		std::size_t batch_size_;
+		std::vector<std::chrono::nanoseconds> latencies_;
+		std::size_t values_ = 0;
+		std::chrono::steady_clock::time_point window_start_;
+		// The best throughput seen since the batch size last shrank, in values per second.
+		double best_throughput_ = 0;
+		// The batch size that last missed the target, and the windows within it since then.
+		std::size_t ceiling_ = std::numeric_limits<std::size_t>::max();
+		std::size_t held_windows_ = 0;
+	};
+
+	// Exponential backoff for a source that keeps returning `poll::empty`.
+	// Once it has been empty `threshold` times in a row, it is skipped for 1, 2, 4, ... steps
+	// (up to `max_skip`, at least 1), and treated as empty in those steps. A ready poll resets it to full rate.
+	struct backoff_policy {
+		std::size_t threshold = 1;
+		std::size_t max_skip = 64;
+	};
+
+	// Counters kept for each node while the pipeline runs.
+	struct poll_stats {
+		// Calls to `poll_next()`, and what they returned.
+		std::size_t polls = 0;
+		std::size_t ready = 0;
+		std::size_t empty = 0;
+		std::size_t closed = 0;
+		// Steps in which a backing-off source was not polled.
+		std::size_t skipped = 0;
+		// Steps in which a folded node reused its last value instead of being polled.
+		std::size_t cached = 0;
+		// Time spent in `poll_next()`, only measured while profiling.
+		std::chrono::nanoseconds busy{0};
+	};
+
+	// Where a node should run when a pipeline is executed on several threads.
+	struct placement {
+		// Pin the worker running this node to these CPUs.
+		std::vector<unsigned> cpus = {};
+		// Run this node on the NUMA node of the CPUs running another node, typically its source.
+		std::optional<int> numa_of = std::nullopt;
+		// Run this node on the same worker as another node.
+		std::optional<int> colocate_with = std::nullopt;
+	};
+
+	// Work in a pipeline that never reaches a sink, found by `pipeline::find_dead_nodes()`.
+	struct dead_node_report {
+		// Nodes whose output cannot reach any sink that is not excluded.
+		std::vector<int> unreachable;
+		// The sources among them: nothing they produce is ever consumed.
+		std::vector<int> stranded_sources;
+		// Connected nodes that have not been polled so far.
+		std::vector<int> never_polled;
+	};
+
 	class node {
 	 public:
 		[[nodiscard]] virtual auto name() const -> std::string = 0;
 		virtual ~node() = default;
 
+		// No value this node produces from now on has an event time before its watermark.
+		[[nodiscard]] auto watermark() const noexcept -> std::int64_t {
+			return watermark_.load(std::memory_order_acquire);
+		}
+
+	 protected:
+		// The smallest watermark of the inputs of this node, as of its current poll. A value still
+		// queued on a buffered input holds the watermark of that input back until it is consumed.
+		[[nodiscard]] auto input_watermark() const noexcept -> std::int64_t {
+			return input_watermark_;
+		}
+		// Promise that no value produced from now on has an event time before `time`. A node that
+		// does this keeps its own watermark; any other node passes on the watermark of its inputs.
+		void advance_watermark(std::int64_t time) noexcept {
+			if (!own_watermark_ || time > *own_watermark_) {
+				own_watermark_ = time;
+			}
+		}
+
 	 private:
 		[[nodiscard]] virtual auto poll_next() -> poll = 0;
 		virtual void connect(const node* source, int slot) = 0;
@@ -54,6 +378,35 @@ namespace ppl {
 		using slot_id = int;
 		std::unordered_map<slot_id, const int> connections_;
 		std::vector<std::pair<int, int>> dependencies_;
+		// Buffered input connections, keyed by slot.
+		std::unordered_map<slot_id, std::unique_ptr<internal::edge_buffer>> buffers_;
+		// How many times a source feeding only buffered connections is polled in a single step.
+		std::size_t batch_size_ = 1;
+		std::unique_ptr<batch_controller> batch_controller_;
+		std::optional<backoff_policy> backoff_;
+		std::size_t empty_streak_ = 0;
+		std::size_t backoff_skip_ = 0;
+		std::size_t backoff_remaining_ = 0;
+		poll_stats stats_;
+		// Closed for good: skipped by step() until re-armed.
+		bool retired_ = false;
+		// Left out of execution and treated as closed, but still part of the graph.
+		bool excluded_ = false;
+		struct placement placement_;
+		// Set for pure nodes: compares two nodes of the same type.
+		bool (*equivalent_)(const node&, const node&) = nullptr;
+		// Constant folding: a folded node keeps its last value for as long as its source's version,
+		// or the versions of all its inputs, stay the same.
+		bool folded_ = false;
+		std::optional<std::uint64_t> folded_version_;
+		std::uint64_t fold_epoch_ = 0;
+		// Published by step() once the values of a poll are handed on, so that no consumer can see
+		// the watermark before the values it came after.
+		std::atomic<std::int64_t> watermark_ = no_watermark;
+		std::int64_t input_watermark_ = no_watermark;
+		std::optional<std::int64_t> own_watermark_;
+		// The number of input slots, worked out by the first step that reaches this node.
+		std::optional<std::size_t> input_count_;
 
 		virtual auto get_input_types() const noexcept -> std::vector<std::type_index> {
 			return {};
@@ -61,8 +414,24 @@ namespace ppl {
 		virtual auto get_output_type() const noexcept -> std::type_index {
 			return typeid(void);
 		}
+		// Only producers of a copyable, non-void type can feed a buffered connection.
+		virtual auto make_buffer() const -> std::unique_ptr<internal::edge_buffer> {
+			return nullptr;
+		}
+		// A source whose value is constant, or changes rarely, returns a version number that changes
+		// whenever its value does. Between changes, `fold_constants()` lets step() reuse its value.
+		[[nodiscard]] virtual auto version() const noexcept -> std::optional<std::uint64_t> {
+			return std::nullopt;
+		}
+		// Set for a node that is polled whatever its inputs did, and chooses which of them to take from.
+		[[nodiscard]] virtual auto selection() noexcept -> internal::input_selection* {
+			return nullptr;
+		}
 
 		friend class pipeline;
+		friend class subgraph;
+		template <typename C>
+		friend struct memoised;
 	};
 
 	template <typename Output>
@@ -74,6 +443,7 @@ namespace ppl {
 		auto get_output_type() const noexcept -> std::type_index override {
 			return typeid(Output);
 		}
+		auto make_buffer() const -> std::unique_ptr<internal::edge_buffer> override;
 	};
 
 	template <>
@@ -81,34 +451,245 @@ namespace ppl {
 		using output_type = void;
 	};
 
+	namespace internal {
+		template <typename T>
+		struct typed_edge_buffer final: producer<T>, edge_buffer {
+			~typed_edge_buffer() override {
+				clear();
+			}
+			[[nodiscard]] auto name() const -> std::string override {
+				return "EdgeBuffer";
+			}
+			auto value() const -> const T& override {
+				return queue_.front();
+			}
+			void push(const node* src) override {
+				const auto& value = static_cast<const producer<T>*>(src)->value();
+				const auto bytes = footprint(value);
+				if constexpr (spillable<T>) {
+					// Once anything is spilled, later values must follow it to keep them in order.
+					// At least one value always stays in memory, so that `value()` can return it.
+					const auto must_spill = spilled_ != 0 || queue_.size() >= capacity
+					                        || budget->used + bytes > budget->limit;
+					if (on_overflow == overflow::spill && !queue_.empty() && must_spill && !spill_failed && file_.open()) {
+						try {
+							spill_codec<T>::write(file_, value);
+							++spilled_;
+							return;
+						} catch (...) {
+							// Whatever part of the value reached the file is never read back
+							spill_failed = true;
+						}
+					}
+					if (spilled_ != 0) {
+						tail_.push_back(value);
+						hold(bytes);
+						return;
+					}
+				}
+				queue_.push_back(value);
+				hold(bytes);
+			}
+			void pop() override {
+				const auto bytes = footprint(queue_.front());
+				queue_.pop_front();
+				release(bytes);
+				if constexpr (spillable<T>) {
+					// Read the spilled values back once the ones in memory are consumed, while the
+					// budget has room left
+					if (queue_.empty() && spilled_ != 0) {
+						try {
+							do {
+								queue_.push_back(spill_codec<T>::read(file_));
+								hold(footprint(queue_.back()));
+								--spilled_;
+							} while (spilled_ != 0 && queue_.size() < capacity && budget->used < budget->limit);
+						} catch (...) {
+							// The values left in the file are lost. Dropping the last marks instead of
+							// theirs only holds the watermark back until the buffer drains
+							spill_failed = true;
+							drop_marks(spilled_);
+							spilled_ = 0;
+						}
+						if (spilled_ == 0) {
+							file_.reset();
+							std::move(tail_.begin(), tail_.end(), std::back_inserter(queue_));
+							tail_.clear();
+						}
+					}
+				}
+			}
+			void clear() noexcept override {
+				if (budget != nullptr) {
+					budget->used -= bytes_;
+				}
+				bytes_ = 0;
+				queue_.clear();
+				tail_.clear();
+				spilled_ = 0;
+				file_.reset();
+			}
+			[[nodiscard]] auto size() const noexcept -> std::size_t override {
+				return queue_.size() + spilled_ + tail_.size();
+			}
+			[[nodiscard]] auto can_spill() const noexcept -> bool override {
+				return spillable<T>;
+			}
+			[[nodiscard]] auto as_node() const noexcept -> const node* override {
+				return static_cast<const producer<T>*>(this);
+			}
+
+		 private:
+			// A buffer is never part of the graph itself, so it is never polled or connected.
+			[[nodiscard]] auto poll_next() -> poll override {
+				return queue_.empty() ? poll::empty : poll::ready;
+			}
+			void connect([[maybe_unused]] const node* source, [[maybe_unused]] int slot) override {
+				throw pipeline_error(pipeline_error_kind::no_such_slot);
+			}
+
+			void hold(std::size_t bytes) noexcept {
+				budget->used += bytes;
+				bytes_ += bytes;
+			}
+			void release(std::size_t bytes) noexcept {
+				budget->used -= bytes;
+				bytes_ -= bytes;
+			}
+
+			std::deque<T> queue_;
+			// The memory held by the values in `queue_` and `tail_`
+			std::size_t bytes_ = 0;
+			// The values after the ones in `queue_`, in the order they were pushed.
+			spill_file file_;
+			std::size_t spilled_ = 0;
+			// The values after the spilled ones, pushed once the file failed.
+			std::deque<T> tail_;
+		};
+	}
+
+	template <typename Output>
+	auto producer<Output>::make_buffer() const -> std::unique_ptr<internal::edge_buffer> {
+		if constexpr (std::is_copy_constructible_v<Output>) {
+			return std::make_unique<internal::typed_edge_buffer<Output>>();
+		} else {
+			return nullptr;
+		}
+	}
+
 	/**
 	 * Helper Functions
 	 */
 	namespace internal {
 		template<typename Tuple, std::size_t... Indexes>
-		auto get_types(const Tuple&, std::index_sequence<Indexes...>) noexcept -> std::vector<std::type_index> {
+		auto get_types(std::index_sequence<Indexes...>) noexcept -> std::vector<std::type_index> {
 			return {typeid(std::tuple_element_t<Indexes, Tuple>)...};
 		}
 		template <typename T>
 		struct is_tuple: std::false_type {};
 		template <typename... Ts>
 		struct is_tuple<std::tuple<Ts...>>: std::true_type {};
+		template <typename T>
+		struct is_many: std::false_type {};
 
 	}
 
+	// How a component reads its inputs.
+	enum class input_mode {
+		// Polled once every input is ready, taking a value from each of them.
+		all,
+		// Polled in every step, whatever its inputs did, taking a value only from the inputs passed
+		// to `consume()`. Its inputs are buffered, so the others keep their value for later steps.
+		select,
+	};
+
+	namespace internal {
+		// The state shared by components that may read their inputs with `input_mode::select`.
+		template <typename Output>
+		struct selecting_producer: producer<Output> {
+			// With `input_mode::select`: whether the input on `slot` has a value in this step.
+			[[nodiscard]] auto input_state(std::size_t slot) const -> poll {
+				return selection_.value().states.at(slot);
+			}
+			// With `input_mode::select`: the value on `slot` has been used, and the next one may follow.
+			void consume(std::size_t slot) {
+				selection_.value().consumed.at(slot) = true;
+			}
+
+		 protected:
+			void select_inputs(std::size_t slots) {
+				selection_.emplace(
+				   input_selection{std::vector<poll>(slots, poll::closed), std::vector<bool>(slots, false)});
+			}
+
+		 private:
+			[[nodiscard]] auto selection() noexcept -> input_selection* override {
+				return selection_ ? &*selection_ : nullptr;
+			}
+
+			std::optional<input_selection> selection_;
+		};
+	}
+
 	template <typename Input, typename Output>
-	struct component: producer<Output> {
+	struct component: internal::selecting_producer<Output> {
 		using input_type = Input;
 
+		component() = default;
+		explicit component(input_mode mode) {
+			if (mode == input_mode::select) {
+				this->select_inputs(std::tuple_size_v<Input>);
+			}
+		}
+
 	 private:
 		[[nodiscard]] auto get_input_types() const noexcept -> std::vector<std::type_index> override {
-			return internal::get_types(input_type{}, std::make_index_sequence<std::tuple_size_v<input_type>>{});
+			return internal::get_types<input_type>(std::make_index_sequence<std::tuple_size_v<input_type>>{});
 		}
 		[[nodiscard]] auto get_output_type() const noexcept -> std::type_index override {
 			return typeid(Output);
 		};
 	};
 
+	// Any number of inputs of type `T`, fixed when the node is constructed.
+	template <typename T>
+	struct many {};
+
+	namespace internal {
+		template <typename T>
+		struct is_many<many<T>>: std::true_type {};
+	}
+
+	// A component with `slots` inputs of the same type, all read through `inputs()`.
+	template <typename T, typename Output>
+	struct component<many<T>, Output>: internal::selecting_producer<Output> {
+		using input_type = many<T>;
+
+		explicit component(std::size_t slots, input_mode mode = input_mode::all): inputs_(slots, nullptr) {
+			if (mode == input_mode::select) {
+				this->select_inputs(slots);
+			}
+		};
+
+		// The producer connected to each slot, or `nullptr` for a slot that is not connected.
+		[[nodiscard]] auto inputs() const noexcept -> std::span<const producer<T>* const> {
+			return inputs_;
+		}
+
+	 private:
+		[[nodiscard]] auto get_input_types() const noexcept -> std::vector<std::type_index> override {
+			return std::vector<std::type_index>(inputs_.size(), typeid(T));
+		}
+		[[nodiscard]] auto get_output_type() const noexcept -> std::type_index override {
+			return typeid(Output);
+		}
+		void connect(const node* source, int slot) override {
+			inputs_.at(static_cast<std::size_t>(slot)) = static_cast<const producer<T>*>(source);
+		}
+
+		std::vector<const producer<T>*> inputs_;
+	};
+
 	template <typename Input>
 	struct sink: component<std::tuple<Input>, void> {};
 
@@ -120,6 +701,23 @@ namespace ppl {
 		};
 	};
 
+	namespace internal {
+		// The nodes step() starts from, cached between steps.
+		struct plan {
+			// Producers of buffered connections, polled ahead of the roots.
+			std::vector<std::pair<int, node*>> feeders;
+			// The sinks, and when running partitioned, the producers feeding another partition.
+			std::vector<std::pair<int, node*>> roots;
+		};
+
+		struct step_result {
+			bool all_closed = true;
+			bool sinks_closed = true;
+			// Whether any root was ready.
+			bool progress = false;
+		};
+	}
+
 	// The requirements that a type `N` must satisfy
 	// to be used as a component in a pipeline.
 	template <typename N>
@@ -127,16 +725,56 @@ namespace ppl {
 	concept concrete_node = requires(N n) {
 		typename N::input_type;
 		typename N::output_type;
-	} and internal::is_tuple<typename N::input_type>::value
+	} and (internal::is_tuple<typename N::input_type>::value or internal::is_many<typename N::input_type>::value)
 		and std::is_base_of_v<producer<typename N::output_type>, N>;
 
+	// A node type may declare itself pure with `static constexpr bool is_pure = true;` and an
+	// `operator==` comparing its constructor parameters. Two pure nodes that compare equal and have
+	// the same input connections always produce the same values, so one of them can stand in for both.
+	template <typename N>
+	concept pure_node = concrete_node<N> and bool(N::is_pure) and std::equality_comparable<N>;
+
+	class subgraph;
+
+	// A reusable group of nodes that is created and connected like a single node. `build()` creates
+	// the nodes inside, connects them, and binds each input slot of the composite to an input slot of
+	// one of them, and its output to one of them. The pipeline flattens a composite as it creates it:
+	// its ID then stands for those nodes, and connections to and from it go straight to them.
+	template <typename Input, typename Output>
+	struct composite {
+		using input_type = Input;
+		using output_type = Output;
+
+		virtual ~composite() = default;
+		virtual void build(subgraph& graph) const = 0;
+	};
+
+	template <typename N>
+	concept composite_node = requires {
+		typename N::input_type;
+		typename N::output_type;
+	} and internal::is_tuple<typename N::input_type>::value
+		and std::is_base_of_v<composite<typename N::input_type, typename N::output_type>, N>;
+
+	namespace internal {
+		// What the ID of a flattened composite stands for.
+		struct composite_wiring {
+			std::vector<std::type_index> input_types;
+			std::type_index output_type;
+			// The slot of an inner node behind each input slot.
+			std::vector<std::optional<std::pair<int, int>>> inputs;
+			std::optional<int> output;
+			std::vector<int> members;
+		};
+	}
+
 	class pipeline {
 	 public:
 		// 3.6.1
 		using node_id = int;
 
 		// 3.6.2
-		pipeline(): nodes_(), current_id(1) {};
+		pipeline(): nodes_(), current_id(1), budget_(std::make_shared<internal::memory_budget>()) {};
 		pipeline(const pipeline &) = delete;
 		pipeline(pipeline&&) noexcept;
 		auto operator=(const pipeline &) -> pipeline& = delete;
@@ -147,10 +785,48 @@ namespace ppl {
 		template <typename N, typename... Args>
 		requires concrete_node<N> and std::constructible_from<N, Args...>
 		auto create_node(Args&& ...args) noexcept -> node_id {
-			nodes_.emplace(current_id, new N(std::forward<Args>(args)...));
-			return current_id++;
+			node* n = new N(std::forward<Args>(args)...);
+			describe<N>(n);
+			return add_node(n);
+		}
+		// The ID of a composite stands for the nodes inside in `connect`, `disconnect`, `erase_node`,
+		// `set_buffer`, `buffer_size` and `get_dependencies`. Throws `no_such_slot` if `build()` leaves
+		// a slot or the output unbound, in which case none of the nodes it created are kept.
+		template <typename N, typename... Args>
+		requires composite_node<N> and std::constructible_from<N, Args...>
+		auto create_node(Args&& ...args) -> node_id {
+			const N composite(std::forward<Args>(args)...);
+			using input_type = typename N::input_type;
+			auto wiring = internal::composite_wiring{
+			   .input_types = internal::get_types<input_type>(std::make_index_sequence<std::tuple_size_v<input_type>>{}),
+			   .output_type = typeid(typename N::output_type),
+			   .inputs = std::vector<std::optional<std::pair<int, int>>>(std::tuple_size_v<input_type>),
+			   .output = std::nullopt,
+			   .members = {},
+			};
+			return add_composite(std::move(wiring), [&composite](subgraph& graph) {
+				composite.build(graph);
+			});
 		}
 		void erase_node(node_id n_id);
+		// Put `replacement` behind `n_id` in place of the node there, with the same connections and
+		// the values queued on them. Its input and output types must match those of the old node.
+		// `transfer` is called with the old node and the new one first, so the new one can take over
+		// the state of the old one; nothing is changed if it throws.
+		template <typename N, typename Transfer>
+		requires concrete_node<N> and std::invocable<Transfer&, node&, N&>
+		void replace_node(node_id n_id, std::unique_ptr<N> replacement, Transfer&& transfer) {
+			auto& next = *replacement;
+			describe<N>(replacement.get());
+			swap_node(n_id, std::move(replacement), [&transfer, &next](node& old) {
+				transfer(old, next);
+			});
+		}
+		template <typename N>
+		requires concrete_node<N>
+		void replace_node(node_id n_id, std::unique_ptr<N> replacement) {
+			replace_node(n_id, std::move(replacement), []([[maybe_unused]] node& old, [[maybe_unused]] N& next) {});
+		}
 		[[nodiscard]] auto get_node(node_id n_id) const noexcept -> node*;
 
 		// 3.6.4
@@ -158,11 +834,126 @@ namespace ppl {
 		void disconnect(node_id src, node_id dst) const;
 		[[nodiscard]] auto get_dependencies(node_id src) const -> const std::vector<std::pair<node_id, int>>;
 
+		// Queue up to `capacity` values on the connection into `slot` of `dst`, so its producer
+		// can run ahead of a slow consumer. With `overflow::block`, the producer is not polled while
+		// any of its buffered connections is full. With `overflow::spill`, values beyond the capacity
+		// or the memory budget go to a temporary file instead.
+		// A capacity of zero restores the default lockstep connection, except into a node that reads
+		// with `input_mode::select`, which always keeps a buffer of at least one value.
+		void set_buffer(node_id dst, int slot, std::size_t capacity, overflow on_overflow = overflow::block) const;
+		[[nodiscard]] auto buffer_size(node_id dst, int slot) const -> std::size_t;
+		// Whether the spill file of the buffer into `slot` of `dst` failed, say because the disk is
+		// full. From then on the buffer keeps its values in memory, whatever the memory budget, and
+		// any values that could not be read back from the file are lost.
+		[[nodiscard]] auto spill_failed(node_id dst, int slot) const -> bool;
+		// Spilling buffers keep the memory held by all the buffers of the pipeline under `bytes`. A
+		// value counts as `sizeof` its type, or as what `spill_codec<T>::size()` gives where its codec
+		// has one, as that of `std::string` does. The watermarks kept with queued values count too, once
+		// for each run of values under the same watermark.
+		void set_memory_budget(std::size_t bytes) noexcept;
+		[[nodiscard]] auto memory_in_use() const noexcept -> std::size_t;
+
+		// Changes collected to be applied together by `commit()`, as a single change to the pipeline:
+		// the plan is rebuilt once, and if any of them throws, the pipeline is left as it was.
+		class transaction {
+		 public:
+			explicit transaction(pipeline& p) noexcept: pipeline_(p) {};
+			transaction(const transaction&) = delete;
+			auto operator=(const transaction&) -> transaction& = delete;
+
+			// The node is created right away, but only added to the pipeline by `commit()`.
+			template <typename N, typename... Args>
+			requires concrete_node<N> and std::constructible_from<N, Args...>
+			auto create_node(Args&& ...args) -> node_id {
+				auto n = std::make_unique<N>(std::forward<Args>(args)...);
+				describe<N>(n.get());
+				const auto id = pipeline_.reserve_id();
+				changes_.push_back({.what = change::kind::create, .id = id, .created = std::move(n)});
+				return id;
+			}
+			void erase_node(node_id n_id);
+			void connect(node_id src, node_id dst, int slot);
+			void disconnect(node_id src, node_id dst);
+			void set_buffer(node_id dst, int slot, std::size_t capacity, overflow on_overflow = overflow::block);
+			[[nodiscard]] auto size() const noexcept -> std::size_t;
+			// Apply every change in order. Either all of them are applied, or the first one to throw
+			// is rethrown with the pipeline unchanged. The transaction is empty afterwards.
+			void commit();
+
+		 private:
+			struct change {
+				enum class kind {create, erase, connect, disconnect, set_buffer} what;
+				// The node created or erased, or the source of a connection.
+				node_id id = 0;
+				node_id dst = 0;
+				int slot = 0;
+				std::size_t capacity = 0;
+				overflow on_overflow = overflow::block;
+				std::unique_ptr<node> created = nullptr;
+			};
+
+			pipeline& pipeline_;
+			std::vector<change> changes_;
+
+			friend class pipeline;
+		};
+
+		// `create_node`, `erase_node`, `connect`, `disconnect` and `set_buffer` may be called from
+		// another thread while run() is executing: the change lands between two steps, and run() goes
+		// on with a plan rebuilt to match. Changes wait for run_partitioned() to return instead.
+
 		// 3.6.5
 		[[nodiscard]] auto is_valid() const noexcept -> bool;
 		[[nodiscard]] auto step() const noexcept -> bool;
 		void run() const noexcept;
 
+		// Split the graph into `groups` groups of roughly equal cost, cutting as little traffic between
+		// them as possible. Costs and traffic come from the poll_stats of each node, so profile a run
+		// first for a useful result; without it, every node and connection counts the same.
+		// Of the placement hints, colocated nodes and nodes pinned to the same CPUs end up in one group,
+		// and nodes pinned to different CPUs in different groups where there are enough of them.
+		// `numa_of` only picks the CPUs of a worker, so it is left to run_partitioned().
+		[[nodiscard]] auto partition(std::size_t groups) const -> std::vector<std::vector<node_id>>;
+		// Run until every sink is closed, with each group of nodes on its own pinned worker thread.
+		// Connections between groups get a buffer of `boundary_capacity` if they have none yet,
+		// which is removed again once the run is over.
+		// Nodes not in any group run with the first one, and colocated nodes with the node they are
+		// colocated with. A worker is pinned to the CPUs of its nodes, or else to the NUMA node of the
+		// worker running their `numa_of` node.
+		void run_partitioned(const std::vector<std::vector<node_id>>& groups, std::size_t boundary_capacity = 1024) const;
+		// Placement hints, used by partition() and run_partitioned() as described there.
+		void set_placement(node_id n_id, placement hints) const;
+		[[nodiscard]] auto get_placement(node_id n_id) const -> placement;
+		// Measure the time each node spends in `poll_next()`, in poll_stats::busy.
+		void set_profiling(bool enabled) noexcept;
+
+		// A source whose connections are all buffered may be polled up to `batch` times in a single
+		// step, for as long as it is ready and none of its buffers is full.
+		void set_batch_size(node_id src, std::size_t batch) const;
+		// Let the batch size of a source follow its observed latency and throughput instead.
+		void set_adaptive_batching(node_id src, batch_policy policy) const;
+		[[nodiscard]] auto batch_size(node_id src) const -> std::size_t;
+		// Poll a quiet source less often. Has no effect on nodes with inputs.
+		void set_backoff(node_id src, std::optional<backoff_policy> policy) const;
+		[[nodiscard]] auto stats(node_id n_id) const -> poll_stats;
+		// Once a node is closed, skip it and everything depending on it in later steps,
+		// until one of them is connected again or re-armed.
+		void set_prune_closed(bool enabled) noexcept;
+		void rearm(node_id n_id) const;
+		[[nodiscard]] auto find_dead_nodes() const -> dead_node_report;
+		// Leave a node out of execution without erasing it: step() treats it as closed.
+		void set_excluded(node_id n_id, bool excluded) const;
+		// Exclude every node whose output cannot reach a sink, and return how many there were.
+		auto eliminate_dead_nodes() const -> std::size_t;
+		// Merge pure nodes that are equivalent and have the same inputs, moving all the dependents of
+		// the duplicates onto the node that is kept. Meant to run before the pipeline is stepped,
+		// since merged nodes must not have diverged in state. Returns how many nodes were erased.
+		auto eliminate_common_subexpressions() -> std::size_t;
+		// Fold every versioned source, and every pure node whose inputs are all folded, so step()
+		// only polls them again when a version changes. Returns how many nodes were folded or unfolded
+		// since the last call, so that running it again on an unchanged graph returns 0.
+		auto fold_constants() const -> std::size_t;
+
 		// 3.6.6
 		friend std::ostream &operator<<(std::ostream &, const pipeline &);
 
@@ -170,8 +961,96 @@ namespace ppl {
 	 private:
 		std::map<node_id, node*> nodes_;
 		node_id current_id;
+		// Shared with the buffers, which may outlive a moved-from pipeline.
+		std::shared_ptr<internal::memory_budget> budget_;
+		bool prune_closed_ = false;
+		bool profiling_ = false;
+		// Rebuilt by the next step() after any change to the graph.
+		mutable std::optional<internal::plan> plan_;
+		// Held shared by each step and exclusively by each change to the graph.
+		mutable std::shared_mutex graph_mutex_;
+		// Serialises changes, including the plan rebuilt after each of them while run() goes on.
+		mutable std::mutex mutation_mutex_;
+		// The thread holding `mutation_mutex_`, whose further changes are part of its current one.
+		mutable std::atomic<std::thread::id> mutator_;
+		// Changes waiting for `graph_mutex_`, which run() lets through before its next step.
+		mutable std::atomic<int> pending_mutations_ = 0;
+		mutable std::atomic<bool> running_ = false;
+		std::map<node_id, internal::composite_wiring> composites_;
+		// Erased while a plan that may still reach them was in use, deleted once it is replaced.
+		mutable std::vector<node*> erased_;
+		// While a transaction is committed, buffers dropped from the graph are kept here instead,
+		// in case it has to be rolled back.
+		mutable std::vector<std::unique_ptr<internal::edge_buffer>>* dropped_buffers_ = nullptr;
+
+		// What the pipeline needs to know about a node that only its concrete type can tell.
+		template <typename N>
+		static void describe(node* n) noexcept {
+			if constexpr (pure_node<N>) {
+				n->equivalent_ = [](const node& a, const node& b) {
+					return static_cast<const N&>(a) == static_cast<const N&>(b);
+				};
+			}
+		}
+		auto add_node(node* n) noexcept -> node_id;
+		auto reserve_id() noexcept -> node_id;
+		auto add_composite(internal::composite_wiring wiring, const std::function<void(subgraph&)>& build) -> node_id;
+		// The node and slot behind an ID, which may be a composite.
+		[[nodiscard]] auto resolve_output(node_id n_id) const noexcept -> node_id;
+		[[nodiscard]] auto resolve_input(node_id n_id, int slot) const -> std::pair<node_id, int>;
+		void commit(std::vector<transaction::change> changes);
+		void drop_buffer(node* n, int slot) const;
+		void swap_node(node_id n_id, std::unique_ptr<node> replacement, const std::function<void(node&)>& transfer);
+		// Apply `change` to the graph between two steps, then replace the plan.
+		template <typename Change>
+		void mutate(Change&& change) const;
+		[[nodiscard]] auto build_plan() const -> internal::plan;
+		void rearm_cone(node* n) const noexcept;
+		// One step starting from the nodes of `plan`. With `members`, only those nodes are polled,
+		// and inputs from outside must come through buffers.
+		auto step_plan(internal::plan& plan, const std::unordered_set<node_id>* members) const noexcept
+		   -> internal::step_result;
+		// What a folded node's cached value was computed from: its version for a source, or the
+		// epochs of its inputs otherwise. Empty when it cannot be folded any more.
+		[[nodiscard]] auto folded_version(const node* n) const noexcept -> std::optional<std::uint64_t>;
+		[[nodiscard]] auto is_fold_current(const node* n) const noexcept -> bool;
+		// The node at the end of a chain of `colocate_with` hints.
+		[[nodiscard]] auto colocation_root(node_id n_id) const noexcept -> node_id;
+		// Every node after all of its inputs. Nodes on a cycle are left out.
+		[[nodiscard]] auto topological_order() const -> std::vector<node_id>;
+
+		friend class subgraph;
     };
 
+	// Where a composite builds the nodes it is made of, in the pipeline it is created in.
+	class subgraph {
+	 public:
+		subgraph(const subgraph&) = delete;
+		auto operator=(const subgraph&) -> subgraph& = delete;
+
+		template <typename N, typename... Args>
+		requires (concrete_node<N> or composite_node<N>) and std::constructible_from<N, Args...>
+		auto create_node(Args&& ...args) -> int {
+			const auto id = pipeline_.create_node<N>(std::forward<Args>(args)...);
+			wiring_.members.push_back(id);
+			return id;
+		}
+		void connect(int src, int dst, int slot);
+		void set_buffer(int dst, int slot, std::size_t capacity, overflow on_overflow = overflow::block);
+		// Feed input `slot` of the composite into `inner_slot` of the inner node `inner`.
+		void bind_input(int slot, int inner, int inner_slot);
+		// Make the value of the inner node `inner` the output of the composite.
+		void bind_output(int inner);
+
+	 private:
+		subgraph(pipeline& p, internal::composite_wiring& wiring) noexcept: pipeline_(p), wiring_(wiring) {};
+
+		pipeline& pipeline_;
+		internal::composite_wiring& wiring_;
+
+		friend class pipeline;
+	};
+
 }
 
 #endif  // COMP6771_PIPELINE_H
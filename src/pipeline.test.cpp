@@ -1,8 +1,17 @@
 #include "./pipeline.h"
 
 #include <catch2/catch.hpp>
+#include <csignal>
+#include <filesystem>
 #include <iostream>
+#include <numeric>
 #include <sstream>
+#include <thread>
+
+#ifdef __linux__
+#include <sched.h>
+#include <sys/resource.h>
+#endif
 
 // Declare some example components
 struct test_sink: ppl::sink<int> {
@@ -846,3 +855,1578 @@ TEST_CASE("Test Case 27: Test << operator produce duplicated lines if one source
 						 "  \"2 TestComponent\" -> \"3 TestSink\"\n"
 						 "}\n");
 }
+
+TEST_CASE("Test Case 28: A buffered connection lets its producer run ahead of a consumer that is waiting on another "
+          "input") {
+	ppl::pipeline p;
+	const int source1 = p.create_node<skip_source>(6);
+	const int source2 = p.create_node<flex_source>(10);
+	const int component = p.create_node<test_component>();
+
+	std::stringstream stream1;
+	std::stringstream stream2;
+	const int sink1 = p.create_node<stream_sink>(stream1);
+	const int sink2 = p.create_node<stream_sink>(stream2);
+
+	REQUIRE_NOTHROW(p.connect(source1, component, 0));
+	REQUIRE_NOTHROW(p.connect(source2, component, 1));
+	REQUIRE_NOTHROW(p.connect(component, sink1, 0));
+	REQUIRE_NOTHROW(p.connect(source2, sink2, 0));
+	REQUIRE_NOTHROW(p.set_buffer(component, 1, 16));
+
+	REQUIRE(p.is_valid());
+
+	// At step 1, source1 is empty, so the value of source2 waits in the buffer
+	REQUIRE_FALSE(p.step());
+	REQUIRE(p.buffer_size(component, 1) == 1);
+	// At step 2, component consumes the oldest value of source2, while the newest one is queued
+	REQUIRE_FALSE(p.step());
+	REQUIRE(p.buffer_size(component, 1) == 1);
+
+	p.run();
+
+	// Component pairs every value of source1 with the oldest queued value of source2,
+	// instead of skipping the values of source2 produced while source1 was empty
+	REQUIRE(stream1.str() == "3 6 9 ");
+	REQUIRE(stream2.str() == "1 2 3 4 5 6 7 8 9 10 ");
+}
+
+TEST_CASE("Test Case 29: A producer is not polled while one of its buffered connections is full") {
+	ppl::pipeline p;
+	const int source1 = p.create_node<skip_source>(6);
+	const int source2 = p.create_node<flex_source>(10);
+	const int component = p.create_node<test_component>();
+
+	std::stringstream stream1;
+	std::stringstream stream2;
+	const int sink1 = p.create_node<stream_sink>(stream1);
+	const int sink2 = p.create_node<stream_sink>(stream2);
+
+	REQUIRE_NOTHROW(p.connect(source1, component, 0));
+	REQUIRE_NOTHROW(p.connect(source2, component, 1));
+	REQUIRE_NOTHROW(p.connect(component, sink1, 0));
+	REQUIRE_NOTHROW(p.connect(source2, sink2, 0));
+	REQUIRE_NOTHROW(p.set_buffer(component, 1, 2));
+
+	// Source2 is held back at step 4 and 6, when the buffer is full, and sink2 is skipped with it.
+	// Once component is closed, its buffer no longer holds source2 back
+	int steps = 1;
+	while (!p.step()) {
+		REQUIRE(p.buffer_size(component, 1) <= 2);
+		++steps;
+	}
+	REQUIRE(steps == 13);
+	REQUIRE(stream1.str() == "3 6 9 ");
+	REQUIRE(stream2.str() == "1 2 3 4 5 6 7 8 9 10 ");
+}
+
+TEST_CASE("Test Case 30: Test failed and removed set_buffer()") {
+	ppl::pipeline p;
+	const int source = p.create_node<flex_source>(10);
+	const int component = p.create_node<test_component>();
+	REQUIRE_NOTHROW(p.connect(source, component, 0));
+
+	try {
+		p.set_buffer(component + 1, 0, 4);
+		REQUIRE(false);
+	} catch (ppl::pipeline_error &e) {
+		REQUIRE(e.kind() == ppl::pipeline_error_kind::invalid_node_id);
+	}
+	// Slot 1 is not connected yet
+	try {
+		p.set_buffer(component, 1, 4);
+		REQUIRE(false);
+	} catch (ppl::pipeline_error &e) {
+		REQUIRE(e.kind() == ppl::pipeline_error_kind::no_such_slot);
+	}
+
+	// A capacity of zero turns the connection back into a lockstep one
+	REQUIRE_NOTHROW(p.set_buffer(component, 0, 4));
+	REQUIRE_NOTHROW(p.set_buffer(component, 0, 0));
+	REQUIRE(p.buffer_size(component, 0) == 0);
+
+	// Disconnecting removes the buffer with the connection
+	REQUIRE_NOTHROW(p.set_buffer(component, 0, 4));
+	REQUIRE_NOTHROW(p.disconnect(source, component));
+	try {
+		p.set_buffer(component, 0, 4);
+		REQUIRE(false);
+	} catch (ppl::pipeline_error &e) {
+		REQUIRE(e.kind() == ppl::pipeline_error_kind::no_such_slot);
+	}
+}
+
+TEST_CASE("Test Case 31: A spilling buffer keeps its overflow in a file, and reads it back in order") {
+	ppl::pipeline p;
+	// Source1 is ready at every other step, while source2 is ready at every step
+	const int source1 = p.create_node<skip_source>(20);
+	const int source2 = p.create_node<flex_source>(10);
+	const int component = p.create_node<test_component>();
+
+	std::stringstream stream1;
+	std::stringstream stream2;
+	const int sink1 = p.create_node<stream_sink>(stream1);
+	const int sink2 = p.create_node<stream_sink>(stream2);
+
+	REQUIRE_NOTHROW(p.connect(source1, component, 0));
+	REQUIRE_NOTHROW(p.connect(source2, component, 1));
+	REQUIRE_NOTHROW(p.connect(component, sink1, 0));
+	REQUIRE_NOTHROW(p.connect(source2, sink2, 0));
+	// Only one value is kept in memory, the rest is spilled. The watermark never changes, so all
+	// their marks are a single run
+	REQUIRE_NOTHROW(p.set_buffer(component, 1, 1, ppl::overflow::spill));
+
+	std::size_t max_queued = 0;
+	while (!p.step()) {
+		REQUIRE(p.memory_in_use() <= sizeof(int) + sizeof(ppl::internal::edge_buffer::mark_run));
+		max_queued = std::max(max_queued, p.buffer_size(component, 1));
+	}
+	// Source2 is never held back, even though the buffer is over its capacity
+	REQUIRE(max_queued == 5);
+	REQUIRE(stream1.str() == "3 6 9 12 15 18 21 24 27 30 ");
+	REQUIRE(stream2.str() == "1 2 3 4 5 6 7 8 9 10 ");
+	REQUIRE(p.memory_in_use() == 0);
+}
+
+TEST_CASE("Test Case 32: The memory budget of a pipeline decides when spilling buffers start to spill") {
+	ppl::pipeline p;
+	const int source1 = p.create_node<skip_source>(20);
+	const int source2 = p.create_node<flex_source>(10);
+	const int component = p.create_node<test_component>();
+
+	std::stringstream stream1;
+	std::stringstream stream2;
+	const int sink1 = p.create_node<stream_sink>(stream1);
+	const int sink2 = p.create_node<stream_sink>(stream2);
+
+	REQUIRE_NOTHROW(p.connect(source1, component, 0));
+	REQUIRE_NOTHROW(p.connect(source2, component, 1));
+	REQUIRE_NOTHROW(p.connect(component, sink1, 0));
+	REQUIRE_NOTHROW(p.connect(source2, sink2, 0));
+	// The capacity alone would keep everything in memory
+	REQUIRE_NOTHROW(p.set_buffer(component, 1, 100, ppl::overflow::spill));
+	const auto budget = 2 * sizeof(int) + sizeof(ppl::internal::edge_buffer::mark_run);
+	p.set_memory_budget(budget);
+
+	while (!p.step()) {
+		REQUIRE(p.memory_in_use() <= budget);
+	}
+	REQUIRE(stream1.str() == "3 6 9 12 15 18 21 24 27 30 ");
+	REQUIRE(stream2.str() == "1 2 3 4 5 6 7 8 9 10 ");
+}
+
+TEST_CASE("Test Case 33: Values are written to and read back from a spill file in order") {
+	ppl::spill_file file;
+	REQUIRE(file.open());
+	ppl::spill_codec<std::string>::write(file, "hello");
+	ppl::spill_codec<int>::write(file, 42);
+	ppl::spill_codec<std::string>::write(file, "");
+	REQUIRE(ppl::spill_codec<std::string>::read(file) == "hello");
+	REQUIRE(ppl::spill_codec<int>::read(file) == 42);
+	REQUIRE(ppl::spill_codec<std::string>::read(file).empty());
+	REQUIRE(file.unread() == 0);
+
+	// Reading more than was written fails instead of making up a value
+	ppl::spill_codec<int>::write(file, 7);
+	REQUIRE(ppl::spill_codec<int>::read(file) == 7);
+	REQUIRE_THROWS_AS(ppl::spill_codec<std::string>::read(file), ppl::pipeline_error);
+	auto huge = std::uint64_t{1} << 40;
+	file.write(&huge, sizeof(huge));
+	REQUIRE_THROWS_AS(ppl::spill_codec<std::string>::read(file), ppl::pipeline_error);
+
+	// The characters of a string count against the memory budget
+	REQUIRE(ppl::internal::footprint(std::string(100, 'x')) == sizeof(std::string) + 100);
+	REQUIRE(ppl::internal::footprint(42) == sizeof(int));
+	REQUIRE(ppl::internal::footprint(std::vector<int>(100)) == sizeof(std::vector<int>));
+
+	// Types without a spill_codec cannot spill
+	STATIC_REQUIRE(ppl::internal::spillable<double>);
+	STATIC_REQUIRE_FALSE(ppl::internal::spillable<std::vector<int>>);
+}
+
+TEST_CASE("Test Case 34: A source feeding only buffered connections is polled up to its batch size in one step") {
+	ppl::pipeline p;
+	const int source = p.create_node<flex_source>(20);
+	std::stringstream stream;
+	const int sink = p.create_node<stream_sink>(stream);
+	REQUIRE_NOTHROW(p.connect(source, sink, 0));
+	REQUIRE_NOTHROW(p.set_buffer(sink, 0, 6));
+	REQUIRE_NOTHROW(p.set_batch_size(source, 4));
+	REQUIRE(p.batch_size(source) == 4);
+
+	// 4 values are produced, and the sink consumes 1 of them
+	REQUIRE_FALSE(p.step());
+	REQUIRE(p.buffer_size(sink, 0) == 3);
+	// The batch stops early once the buffer is full
+	REQUIRE_FALSE(p.step());
+	REQUIRE(p.buffer_size(sink, 0) == 5);
+
+	p.run();
+	REQUIRE(stream.str() == "1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20 ");
+}
+
+TEST_CASE("Test Case 35: A batch controller grows batches while throughput improves, and shrinks them near the "
+          "latency target") {
+	using namespace std::chrono_literals;
+	auto controller = ppl::batch_controller(
+	    {.min_batch = 1, .max_batch = 16, .latency_target = 1ms, .window = 4, .hold_windows = 4});
+	auto now = std::chrono::steady_clock::now();
+	const auto window = [&](std::chrono::nanoseconds latency, std::chrono::nanoseconds step) {
+		for (int i = 0; i < 4; ++i) {
+			now += step;
+			controller.record(controller.batch_size(), latency, now);
+		}
+	};
+	REQUIRE(controller.batch_size() == 1);
+
+	// Each window with a bigger batch is faster overall, so the batch keeps growing up to its maximum
+	for (int i = 0; i < 6; ++i) {
+		window(10us, 100us);
+	}
+	REQUIRE(controller.batch_size() == 16);
+
+	// A p99 latency close to the target halves the batch, which does not grow straight back
+	window(950us, 1ms);
+	REQUIRE(controller.batch_size() == 8);
+	window(10us, 50us);
+	REQUIRE(controller.batch_size() == 8);
+	window(2ms, 2ms);
+	window(2ms, 2ms);
+	window(2ms, 2ms);
+	window(2ms, 2ms);
+	REQUIRE(controller.batch_size() == 1);
+
+	// Only once it has held the target for `hold_windows` windows is the size that missed it tried again
+	for (int i = 0; i < 3; ++i) {
+		window(10us, 100us);
+		REQUIRE(controller.batch_size() == 1);
+	}
+	window(10us, 100us);
+	REQUIRE(controller.batch_size() == 2);
+
+	// When throughput stops improving, the batch size holds
+	window(10us, 400us);
+	REQUIRE(controller.batch_size() == 2);
+}
+
+TEST_CASE("Test Case 36: Adaptive batching keeps the batch size within its bounds") {
+	ppl::pipeline p;
+	const int source = p.create_node<flex_source>(1000);
+	std::stringstream stream;
+	const int sink = p.create_node<stream_sink>(stream);
+	REQUIRE_NOTHROW(p.connect(source, sink, 0));
+	REQUIRE_NOTHROW(p.set_buffer(sink, 0, 64));
+	REQUIRE_NOTHROW(p.set_adaptive_batching(source, {.min_batch = 2, .max_batch = 8, .window = 4}));
+
+	std::size_t max_queued = 0;
+	while (!p.step()) {
+		REQUIRE(p.batch_size(source) >= 2);
+		REQUIRE(p.batch_size(source) <= 8);
+		max_queued = std::max(max_queued, p.buffer_size(sink, 0));
+	}
+	// The source runs ahead of the sink, which only takes one value per step
+	REQUIRE(max_queued > 1);
+	REQUIRE(stream.str().starts_with("1 2 3 4 5 "));
+	REQUIRE(stream.str().ends_with(" 998 999 1000 "));
+}
+
+// A source that has nothing for a while, and then counts up to its bound
+struct quiet_source: ppl::source<int> {
+	int quiet;
+	int current_value = 0;
+	int bound;
+
+	quiet_source(int quiet, int bound): quiet(quiet), bound(bound) {};
+
+	auto name() const -> std::string override {
+		return "QuietSource";
+	}
+
+	auto poll_next() -> ppl::poll override {
+		if (quiet > 0) {
+			--quiet;
+			return ppl::poll::empty;
+		}
+		if (current_value >= bound)
+			return ppl::poll::closed;
+		++current_value;
+		return ppl::poll::ready;
+	}
+
+	auto value() const -> const int& override {
+		return current_value;
+	}
+};
+
+TEST_CASE("Test Case 37: A quiet source backs off exponentially, and returns to full rate once it is ready") {
+	ppl::pipeline p;
+	const int source = p.create_node<quiet_source>(100, 5);
+	std::stringstream stream;
+	const int sink = p.create_node<stream_sink>(stream);
+	REQUIRE_NOTHROW(p.connect(source, sink, 0));
+	REQUIRE_NOTHROW(p.set_backoff(source, ppl::backoff_policy{.threshold = 1, .max_skip = 8}));
+
+	// Skipped for 1, 2, 4, 8, 8, ... steps after each empty poll
+	for (int i = 0; i < 15; ++i) {
+		REQUIRE_FALSE(p.step());
+	}
+	REQUIRE(p.stats(source).polls == 4);
+	REQUIRE(p.stats(source).skipped == 11);
+
+	p.run();
+	REQUIRE(stream.str() == "1 2 3 4 5 ");
+	const auto stats = p.stats(source);
+	REQUIRE(stats.empty == 100);
+	REQUIRE(stats.ready == 5);
+	REQUIRE(stats.closed == 1);
+	// The source is polled far less often than once per step
+	REQUIRE(stats.polls < stats.skipped / 5);
+	REQUIRE(p.stats(sink).polls == 5);
+
+	// A max_skip of 0 still skips a single step
+	ppl::pipeline q;
+	const int quiet = q.create_node<quiet_source>(4, 2);
+	REQUIRE_NOTHROW(q.connect(quiet, q.create_node<stream_sink>(stream), 0));
+	REQUIRE_NOTHROW(q.set_backoff(quiet, ppl::backoff_policy{.threshold = 1, .max_skip = 0}));
+	for (int i = 0; i < 8; ++i) {
+		REQUIRE_FALSE(q.step());
+	}
+	REQUIRE(q.stats(quiet).polls == 4);
+	REQUIRE(q.stats(quiet).skipped == 4);
+}
+
+TEST_CASE("Test Case 38: A source that is empty less often than the backoff threshold keeps its full rate") {
+	ppl::pipeline p;
+	const int source = p.create_node<skip_source>(6);
+	std::stringstream stream;
+	const int sink = p.create_node<stream_sink>(stream);
+	REQUIRE_NOTHROW(p.connect(source, sink, 0));
+	REQUIRE_NOTHROW(p.set_backoff(source, ppl::backoff_policy{.threshold = 2, .max_skip = 8}));
+
+	p.run();
+	REQUIRE(stream.str() == "2 4 6 ");
+	REQUIRE(p.stats(source).polls == 7);
+	REQUIRE(p.stats(source).skipped == 0);
+
+	try {
+		[[maybe_unused]] auto stats = p.stats(sink + 1);
+		REQUIRE(false);
+	} catch (ppl::pipeline_error &e) {
+		REQUIRE(e.kind() == ppl::pipeline_error_kind::invalid_node_id);
+	}
+}
+
+TEST_CASE("Test Case 39: With pruning, a closed node and everything depending on it are skipped in later steps") {
+	ppl::pipeline p;
+	p.set_prune_closed(true);
+	const int source1 = p.create_node<flex_source>(5);
+	const int source2 = p.create_node<flex_source>(10);
+	const int component = p.create_node<test_component>();
+
+	std::stringstream stream1;
+	std::stringstream stream2;
+	const int sink1 = p.create_node<stream_sink>(stream1);
+	const int sink2 = p.create_node<stream_sink>(stream2);
+
+	REQUIRE_NOTHROW(p.connect(source1, component, 0));
+	REQUIRE_NOTHROW(p.connect(source2, component, 1));
+	REQUIRE_NOTHROW(p.connect(component, sink1, 0));
+	REQUIRE_NOTHROW(p.connect(source2, sink2, 0));
+
+	p.run();
+	REQUIRE(stream1.str() == "2 4 6 8 10 ");
+	REQUIRE(stream2.str() == "1 2 3 4 5 6 7 8 9 10 ");
+	// Source1 closed at step 6, and was never polled again
+	REQUIRE(p.stats(source1).polls == 6);
+	REQUIRE(p.stats(source1).closed == 1);
+	REQUIRE(p.stats(source2).polls == 11);
+}
+
+TEST_CASE("Test Case 40: With pruning, a closed subgraph is re-armed when one of its nodes is connected again") {
+	ppl::pipeline p;
+	p.set_prune_closed(true);
+	const int source1 = p.create_node<flex_source>(5);
+	const int source2 = p.create_node<flex_source>(10);
+	const int component = p.create_node<test_component>();
+
+	std::stringstream stream1;
+	std::stringstream stream2;
+	const int sink1 = p.create_node<stream_sink>(stream1);
+	const int sink2 = p.create_node<stream_sink>(stream2);
+
+	REQUIRE_NOTHROW(p.connect(source1, component, 0));
+	REQUIRE_NOTHROW(p.connect(source2, component, 1));
+	REQUIRE_NOTHROW(p.connect(component, sink1, 0));
+	REQUIRE_NOTHROW(p.connect(source2, sink2, 0));
+
+	// The same replacement as in test case 22
+	for (int i = 0; i < 6; ++i) {
+		REQUIRE_FALSE(p.step());
+	}
+	const int source3 = p.create_node<flex_source>(5);
+	REQUIRE_NOTHROW(p.erase_node(source1));
+	REQUIRE_NOTHROW(p.connect(source3, component, 0));
+	REQUIRE(p.is_valid());
+
+	for (int i = 0; i < 4; ++i) {
+		REQUIRE_FALSE(p.step());
+	}
+	REQUIRE(p.step());
+	REQUIRE(stream1.str() == "2 4 6 8 10 8 10 12 14 ");
+	REQUIRE(stream2.str() == "1 2 3 4 5 6 7 8 9 10 ");
+
+	// Re-arming a node without replacing anything only re-derives that it is closed
+	REQUIRE_NOTHROW(p.rearm(sink2));
+	REQUIRE(p.step());
+	REQUIRE(stream2.str() == "1 2 3 4 5 6 7 8 9 10 ");
+	try {
+		p.rearm(source1);
+		REQUIRE(false);
+	} catch (ppl::pipeline_error &e) {
+		REQUIRE(e.kind() == ppl::pipeline_error_kind::invalid_node_id);
+	}
+}
+
+TEST_CASE("Test Case 41: Dead nodes are reported, and can be left out of execution without erasing them") {
+	ppl::pipeline p;
+	const int source1 = p.create_node<flex_source>(10);
+	std::stringstream stream;
+	const int sink = p.create_node<stream_sink>(stream);
+	REQUIRE_NOTHROW(p.connect(source1, sink, 0));
+
+	// A branch that is turned off downstream: component feeds nothing
+	const int source2 = p.create_node<flex_source>(10);
+	const int component = p.create_node<test_component>();
+	REQUIRE_NOTHROW(p.connect(source2, component, 0));
+	REQUIRE_NOTHROW(p.connect(source2, component, 1));
+	// Its buffered connection still makes step() poll source2
+	REQUIRE_NOTHROW(p.set_buffer(component, 0, 4));
+
+	REQUIRE_FALSE(p.step());
+	auto report = p.find_dead_nodes();
+	REQUIRE(report.unreachable == std::vector<int>{source2, component});
+	REQUIRE(report.stranded_sources == std::vector<int>{source2});
+	REQUIRE(report.never_polled == std::vector<int>{component});
+
+	REQUIRE(p.eliminate_dead_nodes() == 2);
+	p.run();
+	REQUIRE(stream.str() == "1 2 3 4 5 6 7 8 9 10 ");
+	// Source2 was only polled in the first step
+	REQUIRE(p.stats(source2).polls == 1);
+	// The nodes are still in the graph
+	REQUIRE(p.get_node(component) != nullptr);
+	REQUIRE(p.get_dependencies(source2).size() == 2);
+	// Excluded nodes are not reported again
+	REQUIRE(p.find_dead_nodes().unreachable.empty());
+
+	REQUIRE_NOTHROW(p.set_excluded(source2, false));
+	REQUIRE(p.find_dead_nodes().unreachable == std::vector<int>{source2});
+}
+
+struct pure_source: flex_source {
+	static constexpr bool is_pure = true;
+
+	explicit pure_source(int bound): flex_source(bound) {};
+
+	auto operator==(const pure_source& other) const -> bool {
+		return bound == other.bound;
+	}
+};
+
+struct pure_scale: ppl::component<std::tuple<int>, int> {
+	static constexpr bool is_pure = true;
+
+	const ppl::producer<int>* slot0 = nullptr;
+	int factor;
+	int current_value = 0;
+
+	explicit pure_scale(int factor): factor(factor) {};
+
+	auto operator==(const pure_scale& other) const -> bool {
+		return factor == other.factor;
+	}
+
+	auto name() const -> std::string override {
+		return "PureScale: Factor = " + std::to_string(factor);
+	}
+
+	void connect(const ppl::node* src, int slot) override {
+		if (slot == 0) {
+			slot0 = dynamic_cast<const ppl::producer<int>*>(src);
+		}
+	}
+
+	auto poll_next() -> ppl::poll override {
+		current_value = slot0->value() * factor;
+		return ppl::poll::ready;
+	}
+
+	auto value() const -> const int& override {
+		return current_value;
+	}
+};
+
+TEST_CASE("Test Case 42: Equivalent pure nodes with the same inputs are merged into one") {
+	STATIC_REQUIRE(ppl::pure_node<pure_source>);
+	STATIC_REQUIRE_FALSE(ppl::pure_node<flex_source>);
+
+	ppl::pipeline p;
+	// Two instances of the same template over the same source
+	const int source1 = p.create_node<pure_source>(5);
+	const int scale1 = p.create_node<pure_scale>(2);
+	std::stringstream stream1;
+	const int sink1 = p.create_node<stream_sink>(stream1);
+	const int source2 = p.create_node<pure_source>(5);
+	const int scale2 = p.create_node<pure_scale>(2);
+	std::stringstream stream2;
+	const int sink2 = p.create_node<stream_sink>(stream2);
+	// A different parameter is not the same node
+	const int scale3 = p.create_node<pure_scale>(3);
+	std::stringstream stream3;
+	const int sink3 = p.create_node<stream_sink>(stream3);
+
+	REQUIRE_NOTHROW(p.connect(source1, scale1, 0));
+	REQUIRE_NOTHROW(p.connect(scale1, sink1, 0));
+	REQUIRE_NOTHROW(p.connect(source2, scale2, 0));
+	REQUIRE_NOTHROW(p.connect(scale2, sink2, 0));
+	REQUIRE_NOTHROW(p.connect(source2, scale3, 0));
+	REQUIRE_NOTHROW(p.connect(scale3, sink3, 0));
+	REQUIRE_NOTHROW(p.set_buffer(sink2, 0, 4));
+
+	// Merging source2 into source1 makes scale2 the same as scale1
+	REQUIRE(p.eliminate_common_subexpressions() == 2);
+	REQUIRE(p.get_node(source2) == nullptr);
+	REQUIRE(p.get_node(scale2) == nullptr);
+	REQUIRE(p.get_dependencies(source1).size() == 2);
+	REQUIRE(p.get_dependencies(scale1).size() == 2);
+	REQUIRE(p.is_valid());
+
+	p.run();
+	REQUIRE(stream1.str() == "2 4 6 8 10 ");
+	REQUIRE(stream2.str() == "2 4 6 8 10 ");
+	REQUIRE(stream3.str() == "3 6 9 12 15 ");
+	REQUIRE(p.stats(source1).polls == 6);
+
+	// A duplicate feeding several slots of one node keeps the buffers on all of them
+	ppl::pipeline q;
+	std::stringstream stream4;
+	const int source3 = q.create_node<pure_source>(5);
+	const int source4 = q.create_node<pure_source>(5);
+	const int add = q.create_node<test_component>();
+	const int sink4 = q.create_node<stream_sink>(stream4);
+	REQUIRE_NOTHROW(q.connect(source3, sink4, 0));
+	REQUIRE_NOTHROW(q.connect(source4, add, 0));
+	REQUIRE_NOTHROW(q.connect(source4, add, 1));
+	REQUIRE_NOTHROW(q.connect(add, q.create_node<stream_sink>(stream4), 0));
+	REQUIRE_NOTHROW(q.set_buffer(sink4, 0, 4));
+	REQUIRE_NOTHROW(q.set_buffer(add, 0, 4));
+	REQUIRE_NOTHROW(q.set_buffer(add, 1, 4));
+	q.set_batch_size(source3, 3);
+	REQUIRE(q.eliminate_common_subexpressions() == 1);
+	REQUIRE_FALSE(q.step());
+	REQUIRE(q.buffer_size(add, 0) == 2);
+	REQUIRE(q.buffer_size(add, 1) == 2);
+}
+
+// A configuration source: its value only changes when it is reloaded
+struct config_source: ppl::source<int> {
+	int current_value;
+	std::uint64_t loaded_version = 0;
+
+	explicit config_source(int value): current_value(value) {};
+
+	auto name() const -> std::string override {
+		return "ConfigSource";
+	}
+
+	auto version() const noexcept -> std::optional<std::uint64_t> override {
+		return loaded_version;
+	}
+
+	void reload(int value) {
+		current_value = value;
+		++loaded_version;
+	}
+
+	auto poll_next() -> ppl::poll override {
+		return ppl::poll::ready;
+	}
+
+	auto value() const -> const int& override {
+		return current_value;
+	}
+};
+
+TEST_CASE("Test Case 43: A versioned source and its pure dependents are polled again only when the version changes") {
+	ppl::pipeline p;
+	const int config = p.create_node<config_source>(10);
+	const int scale = p.create_node<pure_scale>(10);
+	const int source = p.create_node<flex_source>(5);
+	const int component = p.create_node<test_component>();
+	std::stringstream stream;
+	const int sink = p.create_node<stream_sink>(stream);
+
+	REQUIRE_NOTHROW(p.connect(config, scale, 0));
+	REQUIRE_NOTHROW(p.connect(scale, component, 0));
+	REQUIRE_NOTHROW(p.connect(source, component, 1));
+	REQUIRE_NOTHROW(p.connect(component, sink, 0));
+
+	// Component is not pure, and flex_source has no version
+	REQUIRE(p.fold_constants() == 2);
+	REQUIRE(p.fold_constants() == 0);
+
+	REQUIRE_FALSE(p.step());
+	REQUIRE_FALSE(p.step());
+	REQUIRE_FALSE(p.step());
+	// Reloading the configuration recomputes it once
+	dynamic_cast<config_source*>(p.get_node(config))->reload(20);
+	p.run();
+
+	REQUIRE(stream.str() == "101 102 103 204 205 ");
+	// Whether they are reached in the last step depends on which slot of component is checked first
+	REQUIRE(p.stats(config).polls == 2);
+	REQUIRE(p.stats(config).cached >= 3);
+	REQUIRE(p.stats(scale).polls == 2);
+	REQUIRE(p.stats(scale).cached >= 3);
+	REQUIRE(p.stats(component).polls == 5);
+}
+
+TEST_CASE("Test Case 44: partition() balances the groups and keeps connected nodes together") {
+	ppl::pipeline p;
+	std::stringstream stream1;
+	std::stringstream stream2;
+	// Two independent chains of five nodes
+	const int source1 = p.create_node<flex_source>(10);
+	const int scale1 = p.create_node<pure_scale>(2);
+	const int scale2 = p.create_node<pure_scale>(3);
+	const int scale3 = p.create_node<pure_scale>(4);
+	const int sink1 = p.create_node<stream_sink>(stream1);
+	const int source2 = p.create_node<flex_source>(10);
+	const int scale4 = p.create_node<pure_scale>(2);
+	const int scale5 = p.create_node<pure_scale>(3);
+	const int scale6 = p.create_node<pure_scale>(4);
+	const int sink2 = p.create_node<stream_sink>(stream2);
+	REQUIRE_NOTHROW(p.connect(source1, scale1, 0));
+	REQUIRE_NOTHROW(p.connect(scale1, scale2, 0));
+	REQUIRE_NOTHROW(p.connect(scale2, scale3, 0));
+	REQUIRE_NOTHROW(p.connect(scale3, sink1, 0));
+	REQUIRE_NOTHROW(p.connect(source2, scale4, 0));
+	REQUIRE_NOTHROW(p.connect(scale4, scale5, 0));
+	REQUIRE_NOTHROW(p.connect(scale5, scale6, 0));
+	REQUIRE_NOTHROW(p.connect(scale6, sink2, 0));
+
+	auto groups = p.partition(2);
+	REQUIRE(groups.size() == 2);
+	for (auto& group: groups) {
+		std::sort(group.begin(), group.end());
+	}
+	std::sort(groups.begin(), groups.end());
+	// No connection is cut
+	REQUIRE(groups[0] == std::vector<int>{source1, scale1, scale2, scale3, sink1});
+	REQUIRE(groups[1] == std::vector<int>{source2, scale4, scale5, scale6, sink2});
+
+	// A single group holds everything
+	REQUIRE(p.partition(1).front().size() == 10);
+}
+
+TEST_CASE("Test Case 45: A partitioned pipeline runs on several threads with queues at the boundaries") {
+	ppl::pipeline p;
+	const int source1 = p.create_node<flex_source>(1000);
+	const int scale1 = p.create_node<pure_scale>(2);
+	const int source2 = p.create_node<flex_source>(1000);
+	const int scale2 = p.create_node<pure_scale>(3);
+	const int component = p.create_node<test_component>();
+	std::stringstream stream;
+	const int sink = p.create_node<stream_sink>(stream);
+
+	REQUIRE_NOTHROW(p.connect(source1, scale1, 0));
+	REQUIRE_NOTHROW(p.connect(scale1, component, 0));
+	REQUIRE_NOTHROW(p.connect(source2, scale2, 0));
+	REQUIRE_NOTHROW(p.connect(scale2, component, 1));
+	REQUIRE_NOTHROW(p.connect(component, sink, 0));
+	REQUIRE(p.is_valid());
+
+	std::stringstream expected;
+	for (int i = 1; i <= 1000; ++i) {
+		expected << 5 * i << ' ';
+	}
+
+	SECTION("With the groups given") {
+		p.run_partitioned({{source1, scale1}, {source2, scale2}, {component, sink}}, 8);
+		REQUIRE(stream.str() == expected.str());
+		REQUIRE(p.stats(sink).polls == 1000);
+		REQUIRE(p.buffer_size(component, 0) == 0);
+	}
+
+	SECTION("With the groups from a profiled partition") {
+		p.set_profiling(true);
+		REQUIRE_FALSE(p.step());
+		REQUIRE(p.stats(component).busy.count() > 0);
+		p.run_partitioned(p.partition(2));
+		REQUIRE(stream.str() == expected.str());
+	}
+
+	try {
+		p.run_partitioned({{sink + 1}});
+		REQUIRE(false);
+	} catch (ppl::pipeline_error &e) {
+		REQUIRE(e.kind() == ppl::pipeline_error_kind::invalid_node_id);
+	}
+}
+
+TEST_CASE("Test Case 46: Placement hints keep colocated nodes together and pin workers to CPUs") {
+	ppl::pipeline p;
+	std::stringstream stream1;
+	std::stringstream stream2;
+	const int source1 = p.create_node<flex_source>(100);
+	const int scale1 = p.create_node<pure_scale>(2);
+	const int sink1 = p.create_node<stream_sink>(stream1);
+	const int source2 = p.create_node<flex_source>(100);
+	const int scale2 = p.create_node<pure_scale>(3);
+	const int sink2 = p.create_node<stream_sink>(stream2);
+	REQUIRE_NOTHROW(p.connect(source1, scale1, 0));
+	REQUIRE_NOTHROW(p.connect(scale1, sink1, 0));
+	REQUIRE_NOTHROW(p.connect(source2, scale2, 0));
+	REQUIRE_NOTHROW(p.connect(scale2, sink2, 0));
+
+	// Without hints the two chains are split apart; colocation pulls the second sink to the first chain
+	p.set_placement(sink2, {.colocate_with = sink1});
+	p.set_placement(source1, {.cpus = {0}});
+	p.set_placement(source2, {.numa_of = source1});
+	REQUIRE(p.get_placement(sink2).colocate_with == sink1);
+	REQUIRE(p.get_placement(source1).cpus == std::vector<unsigned>{0});
+
+	auto groups = p.partition(2);
+	const auto group_of = [&groups](int id) {
+		for (std::size_t g = 0; g < groups.size(); ++g) {
+			if (std::find(groups[g].begin(), groups[g].end(), id) != groups[g].end()) {
+				return g;
+			}
+		}
+		return groups.size();
+	};
+	REQUIRE(group_of(sink2) == group_of(sink1));
+
+	// Groups that disagree with the hints are overridden
+	p.run_partitioned({{source1, scale1, sink1}, {source2, scale2, sink2}});
+	std::stringstream expected1;
+	std::stringstream expected2;
+	for (int i = 1; i <= 100; ++i) {
+		expected1 << 2 * i << ' ';
+		expected2 << 3 * i << ' ';
+	}
+	REQUIRE(stream1.str() == expected1.str());
+	REQUIRE(stream2.str() == expected2.str());
+
+	try {
+		p.set_placement(sink1, {.colocate_with = sink2 + 1});
+		REQUIRE(false);
+	} catch (ppl::pipeline_error &e) {
+		REQUIRE(e.kind() == ppl::pipeline_error_kind::invalid_node_id);
+	}
+}
+
+struct gated_source: ppl::source<int> {
+	int current_value = 0;
+	const std::atomic<bool>& open;
+
+	explicit gated_source(const std::atomic<bool>& open): open(open) {};
+
+	auto name() const -> std::string override {
+		return "GatedSource";
+	}
+
+	auto poll_next() -> ppl::poll override {
+		if (!open) {
+			return ppl::poll::closed;
+		}
+		++current_value;
+		return ppl::poll::ready;
+	}
+
+	auto value() const -> const int& override {
+		return current_value;
+	}
+};
+
+struct counting_sink: ppl::sink<int> {
+	const ppl::producer<int>* slot0 = nullptr;
+	std::atomic<int>& count;
+	int first = 0;
+	int last = 0;
+
+	explicit counting_sink(std::atomic<int>& count): count(count) {};
+
+	auto name() const -> std::string override {
+		return "CountingSink";
+	}
+
+	void connect(const ppl::node* src, int slot) override {
+		if (slot == 0) {
+			slot0 = dynamic_cast<const ppl::producer<int>*>(src);
+		}
+	}
+
+	auto poll_next() -> ppl::poll override {
+		if (first == 0) {
+			first = slot0->value();
+		}
+		last = slot0->value();
+		++count;
+		return ppl::poll::ready;
+	}
+};
+
+TEST_CASE("Test Case 47: The graph can be changed from another thread while the pipeline runs") {
+	ppl::pipeline p;
+	std::atomic<bool> open = true;
+	std::atomic<int> count1 = 0;
+	std::atomic<int> count2 = 0;
+	const int source = p.create_node<gated_source>(open);
+	const int sink1 = p.create_node<counting_sink>(count1);
+	REQUIRE_NOTHROW(p.connect(source, sink1, 0));
+
+	const auto wait_for = [](const std::atomic<int>& count, int target) {
+		while (count < target) {
+			std::this_thread::yield();
+		}
+	};
+
+	auto runner = std::thread([&p] {
+		p.run();
+	});
+	wait_for(count1, 1);
+
+	// A new sink joins in, on a buffered connection. It is not polled before it is connected, however
+	// many steps run in between
+	const int sink2 = p.create_node<counting_sink>(count2);
+	wait_for(count1, count1 + 100);
+	REQUIRE(count2 == 0);
+	p.connect(source, sink2, 0);
+	p.set_buffer(sink2, 0, 16);
+	wait_for(count2, 100);
+
+	// The old one leaves, and is never polled again
+	p.erase_node(sink1);
+	const int erased_at = count1;
+	wait_for(count2, count2 + 100);
+	REQUIRE(count1 == erased_at);
+
+	REQUIRE_THROWS_AS(p.connect(source, sink1, 0), ppl::pipeline_error);
+
+	open = false;
+	runner.join();
+
+	// The new sink saw every value from the moment it joined, in order
+	auto* sink = dynamic_cast<counting_sink*>(p.get_node(sink2));
+	auto* src = dynamic_cast<gated_source*>(p.get_node(source));
+	REQUIRE(sink->last == src->current_value);
+	REQUIRE(sink->last - sink->first + 1 == count2);
+}
+
+struct accumulator: ppl::component<std::tuple<int>, int> {
+	const ppl::producer<int>* slot0 = nullptr;
+	int factor;
+	int total = 0;
+	int current_value = 0;
+
+	explicit accumulator(int factor): factor(factor) {};
+
+	auto name() const -> std::string override {
+		return "Accumulator: Factor = " + std::to_string(factor);
+	}
+
+	void connect(const ppl::node* src, int slot) override {
+		if (slot == 0) {
+			slot0 = dynamic_cast<const ppl::producer<int>*>(src);
+		}
+	}
+
+	auto poll_next() -> ppl::poll override {
+		total += slot0->value();
+		current_value = total * factor;
+		return ppl::poll::ready;
+	}
+
+	auto value() const -> const int& override {
+		return current_value;
+	}
+};
+
+TEST_CASE("Test Case 48: A node can be replaced in place, keeping its connections and optionally its state") {
+	ppl::pipeline p;
+	std::stringstream stream;
+	const int source = p.create_node<flex_source>(10);
+	const int sum = p.create_node<accumulator>(1);
+	const int sink = p.create_node<stream_sink>(stream);
+	REQUIRE_NOTHROW(p.connect(source, sum, 0));
+	REQUIRE_NOTHROW(p.connect(sum, sink, 0));
+	// The source runs ahead, so values are queued on the connection when the node is replaced
+	p.set_buffer(sum, 0, 8);
+	p.set_batch_size(source, 4);
+
+	for (int i = 0; i < 3; ++i) {
+		REQUIRE_FALSE(p.step());
+	}
+	REQUIRE(stream.str() == "1 3 6 ");
+	const auto queued = p.buffer_size(sum, 0);
+	REQUIRE(queued > 0);
+
+	SECTION("Taking over the state of the old node") {
+		p.replace_node(sum, std::make_unique<accumulator>(10), [](ppl::node& old, accumulator& next) {
+			next.total = dynamic_cast<accumulator&>(old).total;
+		});
+		REQUIRE(p.buffer_size(sum, 0) == queued);
+		REQUIRE(p.get_node(sum)->name() == "Accumulator: Factor = 10");
+		p.run();
+		REQUIRE(stream.str() == "1 3 6 100 150 210 280 360 450 550 ");
+	}
+
+	SECTION("Starting afresh") {
+		p.replace_node(sum, std::make_unique<accumulator>(10));
+		p.run();
+		REQUIRE(stream.str() == "1 3 6 40 90 150 220 300 390 490 ");
+	}
+
+	SECTION("Nothing changes when the types differ or the hook throws") {
+		REQUIRE_THROWS_AS(p.replace_node(sum, std::make_unique<test_component>()), ppl::pipeline_error);
+		REQUIRE_THROWS_AS(p.replace_node(sink + 1, std::make_unique<accumulator>(1)), ppl::pipeline_error);
+		REQUIRE_THROWS_AS(p.replace_node(sum, std::make_unique<accumulator>(10),
+		                                 []([[maybe_unused]] ppl::node& old, [[maybe_unused]] accumulator& next) {
+			                                 throw std::runtime_error("no state to transfer");
+		                                 }),
+		                  std::runtime_error);
+		p.run();
+		REQUIRE(stream.str() == "1 3 6 10 15 21 28 36 45 55 ");
+	}
+}
+
+TEST_CASE("Test Case 49: A transaction applies all of its changes, or none of them") {
+	ppl::pipeline p;
+	std::stringstream stream;
+	const int source = p.create_node<flex_source>(6);
+	const int scale = p.create_node<pure_scale>(2);
+	const int sink = p.create_node<stream_sink>(stream);
+	REQUIRE_NOTHROW(p.connect(source, scale, 0));
+	REQUIRE_NOTHROW(p.connect(scale, sink, 0));
+	p.set_buffer(scale, 0, 8);
+	p.set_batch_size(source, 4);
+	REQUIRE_FALSE(p.step());
+	REQUIRE(stream.str() == "2 ");
+	REQUIRE(p.buffer_size(scale, 0) == 3);
+
+	SECTION("A failing change rolls back the ones before it") {
+		ppl::pipeline::transaction t(p);
+		t.erase_node(scale);
+		const int scale2 = t.create_node<pure_scale>(3);
+		t.connect(source, scale2, 0);
+		t.connect(scale2, sink, 0);
+		t.set_buffer(scale2, 0, 4);
+		t.disconnect(source, sink);
+		// The slot is already taken
+		t.connect(source, scale2, 0);
+		REQUIRE(t.size() == 7);
+		try {
+			t.commit();
+			REQUIRE(false);
+		} catch (ppl::pipeline_error &e) {
+			REQUIRE(e.kind() == ppl::pipeline_error_kind::slot_already_used);
+		}
+		REQUIRE(t.size() == 0);
+
+		REQUIRE(p.get_node(scale2) == nullptr);
+		REQUIRE(p.get_node(scale) != nullptr);
+		REQUIRE(p.get_dependencies(source) == std::vector<std::pair<int, int>>{{scale, 0}});
+		REQUIRE(p.get_dependencies(scale) == std::vector<std::pair<int, int>>{{sink, 0}});
+		REQUIRE(p.buffer_size(scale, 0) == 3);
+		REQUIRE(p.is_valid());
+		p.run();
+		REQUIRE(stream.str() == "2 4 6 8 10 12 ");
+	}
+
+	SECTION("A successful transaction swaps in a new chain") {
+		ppl::pipeline::transaction t(p);
+		t.erase_node(scale);
+		const int scale2 = t.create_node<pure_scale>(3);
+		const int scale3 = t.create_node<pure_scale>(5);
+		t.connect(source, scale2, 0);
+		t.connect(scale2, scale3, 0);
+		t.connect(scale3, sink, 0);
+		t.set_buffer(scale3, 0, 4);
+		t.commit();
+
+		REQUIRE(p.get_node(scale) == nullptr);
+		REQUIRE(p.get_dependencies(scale2) == std::vector<std::pair<int, int>>{{scale3, 0}});
+		REQUIRE(p.is_valid());
+		p.run();
+		REQUIRE(stream.str() == "2 75 90 ");
+	}
+
+	SECTION("Nodes of a transaction that is never committed are not added") {
+		int id = 0;
+		{
+			ppl::pipeline::transaction t(p);
+			id = t.create_node<pure_scale>(3);
+		}
+		REQUIRE(p.get_node(id) == nullptr);
+		REQUIRE(p.create_node<pure_scale>(4) > id);
+	}
+}
+
+// Scales its input by `a`, then by `b`
+struct scale_chain: ppl::composite<std::tuple<int>, int> {
+	int a;
+	int b;
+
+	scale_chain(int a, int b): a(a), b(b) {};
+
+	void build(ppl::subgraph& graph) const override {
+		const int first = graph.create_node<pure_scale>(a);
+		const int second = graph.create_node<pure_scale>(b);
+		graph.connect(first, second, 0);
+		graph.bind_input(0, first, 0);
+		graph.bind_output(second);
+	}
+};
+
+// Adds its inputs, doubled and tripled
+struct weighted_sum: ppl::composite<std::tuple<int, int>, int> {
+	void build(ppl::subgraph& graph) const override {
+		const int left = graph.create_node<scale_chain>(1, 2);
+		const int right = graph.create_node<scale_chain>(3, 1);
+		const int sum = graph.create_node<test_component>();
+		graph.connect(left, sum, 0);
+		graph.connect(right, sum, 1);
+		graph.bind_input(0, left, 0);
+		graph.bind_input(1, right, 0);
+		graph.bind_output(sum);
+	}
+};
+
+// Counts how many of it are alive
+struct counted_scale: pure_scale {
+	static inline int alive = 0;
+
+	counted_scale(): pure_scale(2) {
+		++alive;
+	}
+	counted_scale(const counted_scale&) = delete;
+	auto operator=(const counted_scale&) -> counted_scale& = delete;
+	~counted_scale() override {
+		--alive;
+	}
+};
+
+// Never binds its input
+struct unbound_composite: ppl::composite<std::tuple<int>, int> {
+	void build(ppl::subgraph& graph) const override {
+		graph.bind_output(graph.create_node<counted_scale>());
+	}
+};
+
+TEST_CASE("Test Case 50: A composite is flattened into the nodes it is made of") {
+	ppl::pipeline p;
+	std::stringstream stream;
+	const int source1 = p.create_node<flex_source>(3);
+	const int source2 = p.create_node<flex_source>(3);
+	const int sum = p.create_node<weighted_sum>();
+	const int sink = p.create_node<stream_sink>(stream);
+	REQUIRE_NOTHROW(p.connect(source1, sum, 0));
+	REQUIRE_NOTHROW(p.connect(source2, sum, 1));
+	REQUIRE_NOTHROW(p.connect(sum, sink, 0));
+	REQUIRE(p.is_valid());
+
+	SECTION("A transaction that fails puts back what it changed inside a composite") {
+		ppl::pipeline q;
+		std::stringstream chain_stream;
+		const int chain = q.create_node<scale_chain>(2, 3);
+		const int chain_sink = q.create_node<stream_sink>(chain_stream);
+		REQUIRE_NOTHROW(q.connect(chain, chain_sink, 0));
+		const int chain_source = q.create_node<flex_source>(2);
+
+		ppl::pipeline::transaction connect(q);
+		connect.connect(chain_source, chain, 0);
+		connect.connect(chain_source, 999, 0);
+		REQUIRE_THROWS_AS(connect.commit(), ppl::pipeline_error);
+		REQUIRE(q.get_dependencies(chain_source).empty());
+		REQUIRE_NOTHROW(q.connect(chain_source, chain, 0));
+		REQUIRE(q.is_valid());
+
+		ppl::pipeline::transaction erase(q);
+		erase.erase_node(chain);
+		erase.connect(chain_source, 999, 0);
+		REQUIRE_THROWS_AS(erase.commit(), ppl::pipeline_error);
+		REQUIRE(q.get_dependencies(chain) == std::vector<std::pair<int, int>>{{chain_sink, 0}});
+		REQUIRE(q.is_valid());
+		q.run();
+		REQUIRE(chain_stream.str() == "6 12 ");
+		REQUIRE_NOTHROW(q.erase_node(chain));
+	}
+
+	// Only the nodes inside are part of the graph
+	REQUIRE(p.get_node(sum) == nullptr);
+	REQUIRE(p.get_dependencies(sum) == std::vector<std::pair<int, int>>{{sink, 0}});
+	const auto inner = p.get_dependencies(source1).front();
+	REQUIRE(inner.first != sum);
+	REQUIRE(p.get_node(inner.first)->name() == "PureScale: Factor = 1");
+
+	REQUIRE_NOTHROW(p.set_buffer(sum, 1, 4));
+	REQUIRE(p.buffer_size(sum, 1) == 0);
+	REQUIRE_THROWS_AS(p.connect(source1, sum, 2), ppl::pipeline_error);
+
+	p.run();
+	REQUIRE(stream.str() == "5 10 15 ");
+
+	REQUIRE_NOTHROW(p.disconnect(source2, sum));
+	REQUIRE_FALSE(p.is_valid());
+	REQUIRE_NOTHROW(p.erase_node(sum));
+	REQUIRE(p.get_dependencies(source1).empty());
+	REQUIRE_THROWS_AS(p.erase_node(sum), ppl::pipeline_error);
+
+	try {
+		[[maybe_unused]] const int id = p.create_node<unbound_composite>();
+		REQUIRE(false);
+	} catch (ppl::pipeline_error &e) {
+		REQUIRE(e.kind() == ppl::pipeline_error_kind::no_such_slot);
+	}
+	// Nothing is left behind, not even in memory
+	REQUIRE(counted_scale::alive == 0);
+	std::stringstream graph;
+	graph << p;
+	REQUIRE(graph.str().find("PureScale") == std::string::npos);
+	REQUIRE(graph.str().find("TestComponent") == std::string::npos);
+}
+
+// Adds up any number of inputs
+struct many_sum: ppl::component<ppl::many<int>, int> {
+	int current_value = 0;
+
+	explicit many_sum(std::size_t slots): component(slots) {};
+
+	auto name() const -> std::string override {
+		return "ManySum";
+	}
+
+	auto poll_next() -> ppl::poll override {
+		current_value = 0;
+		for (const auto* input: inputs()) {
+			current_value += input->value();
+		}
+		return ppl::poll::ready;
+	}
+
+	auto value() const -> const int& override {
+		return current_value;
+	}
+};
+
+TEST_CASE("Test Case 51: A component can take any number of inputs of the same type") {
+	STATIC_REQUIRE(ppl::concrete_node<many_sum>);
+
+	ppl::pipeline p;
+	std::stringstream stream;
+	const int sum = p.create_node<many_sum>(std::size_t{64});
+	const int sink = p.create_node<stream_sink>(stream);
+	REQUIRE_NOTHROW(p.connect(sum, sink, 0));
+	for (int slot = 0; slot < 64; ++slot) {
+		REQUIRE_NOTHROW(p.connect(p.create_node<flex_source>(3), sum, slot));
+	}
+	REQUIRE(dynamic_cast<many_sum*>(p.get_node(sum))->inputs().size() == 64);
+	REQUIRE(p.is_valid());
+
+	const int extra = p.create_node<flex_source>(3);
+	try {
+		p.connect(extra, sum, 64);
+		REQUIRE(false);
+	} catch (ppl::pipeline_error &e) {
+		REQUIRE(e.kind() == ppl::pipeline_error_kind::no_such_slot);
+	}
+	try {
+		p.connect(sink, sum, 0);
+		REQUIRE(false);
+	} catch (ppl::pipeline_error &e) {
+		REQUIRE(e.kind() == ppl::pipeline_error_kind::slot_already_used);
+	}
+
+	// A buffered slot reads through its buffer like any other
+	REQUIRE_NOTHROW(p.set_buffer(sum, 5, 4));
+	p.erase_node(extra);
+	p.run();
+	REQUIRE(stream.str() == "64 128 192 ");
+}
+
+// Promises that no later value is before `scale` times its current one
+struct marking_source: flex_source {
+	std::int64_t scale;
+
+	marking_source(int bound, std::int64_t scale): flex_source(bound), scale(scale) {};
+
+	auto poll_next() -> ppl::poll override {
+		const auto res = flex_source::poll_next();
+		advance_watermark(current_value * scale);
+		return res;
+	}
+};
+
+TEST_CASE("Test Case 52: The watermark of a node is the smallest watermark of its inputs") {
+	ppl::pipeline p;
+	std::stringstream stream;
+	const int fast = p.create_node<marking_source>(5, 10);
+	const int slow = p.create_node<marking_source>(5, 3);
+	const int plain = p.create_node<flex_source>(5);
+	const int sum = p.create_node<many_sum>(std::size_t{2});
+	const int unmarked = p.create_node<many_sum>(std::size_t{2});
+	p.connect(fast, sum, 0);
+	p.connect(slow, sum, 1);
+	p.connect(fast, unmarked, 0);
+	p.connect(plain, unmarked, 1);
+	p.connect(sum, p.create_node<stream_sink>(stream), 0);
+	p.connect(unmarked, p.create_node<stream_sink>(stream), 0);
+	REQUIRE(p.get_node(sum)->watermark() == ppl::no_watermark);
+
+	REQUIRE_FALSE(p.step());
+	REQUIRE(p.get_node(fast)->watermark() == 10);
+	REQUIRE(p.get_node(sum)->watermark() == 3);
+	REQUIRE_FALSE(p.step());
+	REQUIRE(p.get_node(sum)->watermark() == 6);
+	// A source that promises nothing holds back everything after it
+	REQUIRE(p.get_node(unmarked)->watermark() == ppl::no_watermark);
+
+	// Once everything has closed, no value can come any more
+	p.run();
+	REQUIRE(p.get_node(sum)->watermark() == ppl::final_watermark);
+	REQUIRE(p.get_node(unmarked)->watermark() == ppl::final_watermark);
+}
+
+// A value whose spill file fails after a number of writes, as if the disk were full
+struct fragile {
+	int value = 0;
+};
+
+namespace ppl {
+	template <>
+	struct spill_codec<fragile> {
+		static inline int writes_left = 0;
+
+		static void write(spill_file& file, const fragile& item) {
+			if (writes_left-- <= 0) {
+				// Half a value reaches the file
+				file.write(&item.value, sizeof(int) / 2);
+				throw pipeline_error(pipeline_error_kind::spill_failed);
+			}
+			file.write(&item.value, sizeof(int));
+		}
+		static auto read(spill_file& file) -> fragile {
+			auto item = fragile();
+			file.read(&item.value, sizeof(int));
+			return item;
+		}
+	};
+}
+
+struct fragile_source: ppl::source<fragile> {
+	fragile current;
+	int bound;
+
+	explicit fragile_source(int bound): bound(bound) {};
+
+	auto name() const -> std::string override {
+		return "FragileSource";
+	}
+
+	auto poll_next() -> ppl::poll override {
+		if (current.value >= bound)
+			return ppl::poll::closed;
+		++current.value;
+		return ppl::poll::ready;
+	}
+
+	auto value() const -> const fragile& override {
+		return current;
+	}
+};
+
+struct fragile_sink: ppl::sink<fragile> {
+	const ppl::producer<fragile>* slot0 = nullptr;
+	std::vector<int>& values;
+
+	explicit fragile_sink(std::vector<int>& values): values(values) {};
+
+	auto name() const -> std::string override {
+		return "FragileSink";
+	}
+
+	void connect(const ppl::node* src, int slot) override {
+		if (slot == 0) {
+			slot0 = dynamic_cast<const ppl::producer<fragile>*>(src);
+		}
+	}
+
+	auto poll_next() -> ppl::poll override {
+		values.push_back(slot0->value().value);
+		return ppl::poll::ready;
+	}
+};
+
+TEST_CASE("Test Case 53: A buffer whose spill file fails keeps its values in memory instead") {
+	SECTION("A value that cannot be written stays in memory, after the ones already spilled") {
+		ppl::pipeline p;
+		std::vector<int> values;
+		const int source = p.create_node<fragile_source>(2000);
+		const int sink = p.create_node<fragile_sink>(values);
+		REQUIRE_NOTHROW(p.connect(source, sink, 0));
+		REQUIRE_NOTHROW(p.set_buffer(sink, 0, 1, ppl::overflow::spill));
+		REQUIRE_NOTHROW(p.set_batch_size(source, 8));
+		ppl::spill_codec<fragile>::writes_left = 100;
+
+		REQUIRE_FALSE(p.spill_failed(sink, 0));
+		p.run();
+		REQUIRE(p.spill_failed(sink, 0));
+		auto expected = std::vector<int>(2000);
+		std::iota(expected.begin(), expected.end(), 1);
+		REQUIRE(values == expected);
+		REQUIRE(p.memory_in_use() == 0);
+	}
+
+#ifdef __linux__
+	SECTION("A spill file that hits the file size limit loses what it held, but the run goes on") {
+		ppl::pipeline p;
+		std::stringstream stream;
+		const int source = p.create_node<flex_source>(20000);
+		const int sink = p.create_node<stream_sink>(stream);
+		REQUIRE_NOTHROW(p.connect(source, sink, 0));
+		REQUIRE_NOTHROW(p.set_buffer(sink, 0, 1, ppl::overflow::spill));
+		REQUIRE_NOTHROW(p.set_batch_size(source, 8));
+
+		// No file may grow at all, and going over the limit is an error rather than a signal
+		auto limit = rlimit();
+		getrlimit(RLIMIT_FSIZE, &limit);
+		auto lowered = limit;
+		lowered.rlim_cur = 0;
+		const auto handler = std::signal(SIGXFSZ, SIG_IGN);
+		setrlimit(RLIMIT_FSIZE, &lowered);
+		p.run();
+		setrlimit(RLIMIT_FSIZE, &limit);
+		std::signal(SIGXFSZ, handler);
+
+		REQUIRE(p.spill_failed(sink, 0));
+		auto values = std::vector<int>();
+		for (auto value = 0; stream >> value;) {
+			values.push_back(value);
+		}
+		REQUIRE(std::is_sorted(values.begin(), values.end()));
+		REQUIRE(values.size() < 20000);
+		REQUIRE(values.front() == 1);
+		REQUIRE(values.back() == 20000);
+		REQUIRE(p.memory_in_use() == 0);
+	}
+#endif
+
+	try {
+		[[maybe_unused]] auto failed = ppl::pipeline().spill_failed(1, 0);
+		REQUIRE(false);
+	} catch (ppl::pipeline_error &e) {
+		REQUIRE(e.kind() == ppl::pipeline_error_kind::invalid_node_id);
+	}
+}
+
+TEST_CASE("Test Case 54: The marks of queued values take memory only where the watermark changes") {
+	ppl::pipeline p;
+	std::stringstream stream;
+	const int source = p.create_node<marking_source>(1000, 1);
+	const int sink = p.create_node<stream_sink>(stream);
+	REQUIRE_NOTHROW(p.connect(source, sink, 0));
+	REQUIRE_NOTHROW(p.set_buffer(sink, 0, 1, ppl::overflow::spill));
+	REQUIRE_NOTHROW(p.set_batch_size(source, 10));
+	constexpr auto run = sizeof(ppl::internal::edge_buffer::mark_run);
+
+	// Every value moves the watermark on, so each one queued has its own mark in memory
+	REQUIRE_FALSE(p.step());
+	REQUIRE(p.buffer_size(sink, 0) == 9);
+	REQUIRE(p.memory_in_use() == sizeof(int) + 9 * run);
+
+	// The same number of values under one watermark share a single mark
+	ppl::pipeline q;
+	const int plain = q.create_node<flex_source>(1000);
+	const int plain_sink = q.create_node<stream_sink>(stream);
+	REQUIRE_NOTHROW(q.connect(plain, plain_sink, 0));
+	REQUIRE_NOTHROW(q.set_buffer(plain_sink, 0, 1, ppl::overflow::spill));
+	REQUIRE_NOTHROW(q.set_batch_size(plain, 10));
+	REQUIRE_FALSE(q.step());
+	REQUIRE(q.buffer_size(plain_sink, 0) == 9);
+	REQUIRE(q.memory_in_use() == sizeof(int) + run);
+
+	p.run();
+	q.run();
+	REQUIRE(p.memory_in_use() == 0);
+	REQUIRE(q.memory_in_use() == 0);
+}
+
+// Produces values that cannot be copied, so cannot be queued
+struct unique_source: ppl::source<std::unique_ptr<int>> {
+	std::unique_ptr<int> current = std::make_unique<int>(0);
+
+	auto name() const -> std::string override {
+		return "UniqueSource";
+	}
+
+	auto poll_next() -> ppl::poll override {
+		++*current;
+		return ppl::poll::ready;
+	}
+
+	auto value() const -> const std::unique_ptr<int>& override {
+		return current;
+	}
+};
+
+struct unique_sink: ppl::sink<std::unique_ptr<int>> {
+	auto name() const -> std::string override {
+		return "UniqueSink";
+	}
+
+	void connect([[maybe_unused]] const ppl::node* src, [[maybe_unused]] int slot) override {}
+
+	auto poll_next() -> ppl::poll override {
+		return ppl::poll::ready;
+	}
+};
+
+TEST_CASE("Test Case 55: A partitioned run that cannot queue a boundary leaves every connection as it was") {
+	ppl::pipeline p;
+	std::stringstream stream;
+	const int source = p.create_node<flex_source>(100);
+	const int sink = p.create_node<stream_sink>(stream);
+	const int unique = p.create_node<unique_source>();
+	const int unique_end = p.create_node<unique_sink>();
+	REQUIRE_NOTHROW(p.connect(source, sink, 0));
+	REQUIRE_NOTHROW(p.connect(unique, unique_end, 0));
+	// A buffered source would run ahead of its sink
+	REQUIRE_NOTHROW(p.set_batch_size(source, 4));
+
+	// Whichever boundary is queued first, the one that cannot be queued fails the run
+	try {
+		p.run_partitioned({{source, unique}, {sink, unique_end}});
+		REQUIRE(false);
+	} catch (ppl::pipeline_error &e) {
+		REQUIRE(e.kind() == ppl::pipeline_error_kind::connection_type_mismatch);
+	}
+
+	// Back in lockstep, the source produces only what the sink takes
+	REQUIRE_FALSE(p.step());
+	REQUIRE(p.buffer_size(sink, 0) == 0);
+	REQUIRE(stream.str() == "1 ");
+	REQUIRE(p.memory_in_use() == 0);
+}
+
+TEST_CASE("Test Case 56: partition() keeps nodes pinned to the same CPUs together and those pinned to others apart") {
+	ppl::pipeline p;
+	std::stringstream stream1;
+	std::stringstream stream2;
+	const int source1 = p.create_node<flex_source>(100);
+	const int scale1 = p.create_node<pure_scale>(2);
+	const int sink1 = p.create_node<stream_sink>(stream1);
+	const int source2 = p.create_node<flex_source>(100);
+	const int scale2 = p.create_node<pure_scale>(3);
+	const int sink2 = p.create_node<stream_sink>(stream2);
+	REQUIRE_NOTHROW(p.connect(source1, scale1, 0));
+	REQUIRE_NOTHROW(p.connect(scale1, sink1, 0));
+	REQUIRE_NOTHROW(p.connect(source2, scale2, 0));
+	REQUIRE_NOTHROW(p.connect(scale2, sink2, 0));
+
+	// Without hints each chain gets a group; the pins cut across the chains instead
+	p.set_placement(source1, {.cpus = {0}});
+	p.set_placement(source2, {.cpus = {0, 0}});
+	p.set_placement(sink1, {.cpus = {1}});
+	p.set_placement(sink2, {.cpus = {1}});
+
+	const auto groups = p.partition(2);
+	const auto group_of = [&groups](int id) {
+		for (std::size_t g = 0; g < groups.size(); ++g) {
+			if (std::find(groups[g].begin(), groups[g].end(), id) != groups[g].end()) {
+				return g;
+			}
+		}
+		return groups.size();
+	};
+	REQUIRE(groups.size() == 2);
+	REQUIRE(group_of(source1) == group_of(source2));
+	REQUIRE(group_of(sink1) == group_of(sink2));
+	REQUIRE(group_of(source1) != group_of(sink1));
+
+	// With a single group the pins cannot all be kept, but every node still has a place
+	const auto single = p.partition(1);
+	REQUIRE(single.size() == 1);
+	REQUIRE(single[0].size() == 6);
+
+	p.run_partitioned(groups);
+	std::stringstream expected1;
+	std::stringstream expected2;
+	for (int i = 1; i <= 100; ++i) {
+		expected1 << 2 * i << ' ';
+		expected2 << 3 * i << ' ';
+	}
+	REQUIRE(stream1.str() == expected1.str());
+	REQUIRE(stream2.str() == expected2.str());
+}
+
+#ifdef __linux__
+// Records the CPUs its worker may run on
+struct affinity_sink: stream_sink {
+	std::vector<unsigned> cpus;
+
+	explicit affinity_sink(std::stringstream& stream): stream_sink(stream) {};
+
+	auto poll_next() -> ppl::poll override {
+		if (cpus.empty()) {
+			cpu_set_t set;
+			CPU_ZERO(&set);
+			sched_getaffinity(0, sizeof(set), &set);
+			for (unsigned cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+				if (CPU_ISSET(cpu, &set)) {
+					cpus.push_back(cpu);
+				}
+			}
+		}
+		return stream_sink::poll_next();
+	}
+};
+
+TEST_CASE("Test Case 57: run_partitioned() runs a `numa_of` node on the NUMA node of the worker it names") {
+	ppl::pipeline p;
+	std::stringstream stream1;
+	std::stringstream stream2;
+	const int source1 = p.create_node<flex_source>(100);
+	const int sink1 = p.create_node<stream_sink>(stream1);
+	const int source2 = p.create_node<flex_source>(100);
+	const int sink2 = p.create_node<affinity_sink>(stream2);
+	REQUIRE_NOTHROW(p.connect(source1, sink1, 0));
+	REQUIRE_NOTHROW(p.connect(source2, sink2, 0));
+	p.set_placement(source1, {.cpus = {0}});
+	p.set_placement(source2, {.numa_of = source1});
+
+	// The CPUs of the NUMA node holding CPU 0, as far as this process may use them
+	cpu_set_t allowed;
+	CPU_ZERO(&allowed);
+	sched_getaffinity(0, sizeof(allowed), &allowed);
+	std::vector<unsigned> expected;
+	auto error = std::error_code();
+	for (const auto& entry: std::filesystem::directory_iterator("/sys/devices/system/node", error)) {
+		if (!entry.path().filename().string().starts_with("node") || !std::filesystem::exists(entry.path() / "cpu0")) {
+			continue;
+		}
+		for (unsigned cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+			if (CPU_ISSET(cpu, &allowed) && std::filesystem::exists(entry.path() / ("cpu" + std::to_string(cpu)))) {
+				expected.push_back(cpu);
+			}
+		}
+	}
+	if (expected.empty()) {
+		expected = {0};
+	}
+
+	p.run_partitioned({{source1, sink1}, {source2, sink2}});
+	REQUIRE(stream1.str() == stream2.str());
+	REQUIRE(dynamic_cast<const affinity_sink*>(p.get_node(sink2))->cpus == expected);
+}
+#endif